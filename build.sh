@@ -0,0 +1,104 @@
+#!/bin/sh
+# Build okx_client for the supported targets.
+#
+#   ./build.sh local    x86-64 binary for the PC        -> okx_client_local
+#   ./build.sh arm      AArch64 binary for the Pi 3/4/5 -> okx_client
+#   ./build.sh armv7    32-bit ARMv7 binary (Pi 2/3)    -> okx_client_armv7
+#   ./build.sh pgo FEED [LOOPS]
+#                       native PGO+LTO binary trained on a recorded feed (--record FILE)
+#                       -> okx_client_pgo_<arch>, with a plain vs PGO report in
+#                          pgo_report_<arch>.txt. Run it on each machine (Pi and PC).
+#   ./build.sh query    time-range query tool over data/ (native) -> okx_query
+#
+# Every binary carries multiversioned hot kernels (see MULTIVERSION in okx.c), so one
+# build per architecture runs at the best ISA level available on each machine.
+# Extra compiler flags can be passed through CFLAGS (e.g. CFLAGS=-DOKX_FIXED_UNIVERSE).
+set -e
+
+TARGET=${1:-local}
+BASE_CFLAGS="-std=gnu11 -O2 -Wall -g"
+LIBS=${LIBS:-"-lwebsockets -lssl -lcrypto -ljansson -lz -lm -lpthread"}
+
+# Run a binary over the feed in a scratch directory and print its [Replay] summary.
+replay_report() {
+    dir=$(mktemp -d)
+    (cd "$dir" && "$1" --replay "$FEED" --replay-loops "$LOOPS" > replay.log 2>&1)
+    grep '\[Replay\]' "$dir/replay.log" | sed 's/\x1b\[[0-9;]*m//g'
+    rm -rf "$dir"
+}
+
+case "$TARGET" in
+    local)
+        CC=${CC:-gcc}
+        ARCH_CFLAGS="-march=x86-64"
+        OUT=okx_client_local
+        ;;
+    arm)
+        CC=${CC:-aarch64-linux-gnu-gcc}
+        ARCH_CFLAGS="-march=armv8-a"
+        OUT=okx_client
+        ;;
+    armv7)
+        # NEON is not part of the baseline so that the VFP-only clones run on any ARMv7.
+        CC=${CC:-arm-linux-gnueabihf-gcc}
+        ARCH_CFLAGS="-march=armv7-a -mfpu=vfpv3-d16 -mfloat-abi=hard"
+        OUT=okx_client_armv7
+        ;;
+    pgo)
+        FEED=$2
+        LOOPS=${3:-5}
+        if [ ! -f "$FEED" ]; then
+            echo "usage: $0 pgo FEED [LOOPS]" >&2
+            exit 1
+        fi
+        FEED=$(cd "$(dirname "$FEED")" && pwd)/$(basename "$FEED")
+        CC=${CC:-gcc}
+        ARCH=$(uname -m)
+        OUT=okx_client_pgo_$ARCH
+        PLAIN=okx_client_plain_$ARCH
+        REPORT=pgo_report_$ARCH.txt
+        WORK=$(mktemp -d)
+        trap 'rm -rf "$WORK"' EXIT
+
+        echo "[build] plain LTO build -> $PLAIN"
+        $CC $BASE_CFLAGS -flto $CFLAGS okx.c -o "$PLAIN" $LIBS
+
+        # The object path must be identical in both PGO steps so the .gcda file matches.
+        echo "[build] instrumented build"
+        $CC $BASE_CFLAGS -fprofile-generate -fprofile-update=atomic $CFLAGS -c okx.c -o "$WORK/okx.o"
+        $CC -fprofile-generate "$WORK/okx.o" -o "$WORK/okx_client_instr" $LIBS
+
+        echo "[build] training on $FEED ($LOOPS loops)"
+        replay_report "$WORK/okx_client_instr" > /dev/null
+
+        echo "[build] PGO+LTO build -> $OUT"
+        $CC $BASE_CFLAGS -flto -fprofile-use -fprofile-correction $CFLAGS -c okx.c -o "$WORK/okx.o"
+        $CC $BASE_CFLAGS -flto "$WORK/okx.o" -o "$OUT" $LIBS
+
+        {
+            echo "PGO report for $ARCH ($($CC --version | head -n 1))"
+            echo "Feed: $FEED, $LOOPS loops"
+            echo
+            echo "== plain (-O2 -flto) =="
+            replay_report "$(pwd)/$PLAIN"
+            echo
+            echo "== PGO (-O2 -flto -fprofile-use) =="
+            replay_report "$(pwd)/$OUT"
+        } > "$REPORT"
+        cat "$REPORT"
+        exit 0
+        ;;
+    query)
+        CC=${CC:-gcc}
+        echo "[build] $CC -> okx_query"
+        $CC $BASE_CFLAGS $CFLAGS okx_query.c -o okx_query -lz -lm -lpthread
+        exit 0
+        ;;
+    *)
+        echo "usage: $0 [local|arm|armv7|pgo FEED [LOOPS]|query]" >&2
+        exit 1
+        ;;
+esac
+
+echo "[build] $CC -> $OUT"
+$CC $BASE_CFLAGS $ARCH_CFLAGS $CFLAGS okx.c -o "$OUT" $LIBS
@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+"""Generate okx_symbols.h for a fixed-universe build of okx.c.
+
+Usage: ./gen_symbols.py [INSTID:PRICE_DECIMALS:SIZE_DECIMALS ...] > okx_symbols.h
+
+The header contains an X-macro list of the symbols and a minimal perfect hash that maps
+each instId directly to its id (0..N-1), so the fixed build needs no interning table.
+Compile okx.c with -DOKX_FIXED_UNIVERSE to use it.
+"""
+import sys
+
+DEFAULT_SYMBOLS = [
+    "BTC-USDT:1:8", "ADA-USDT:4:6", "ETH-USDT:2:6", "DOGE-USDT:5:6",
+    "XRP-USDT:4:6", "SOL-USDT:2:6", "LTC-USDT:2:6", "BNB-USDT:1:6",
+]
+MASK32 = 0xFFFFFFFF
+
+
+def load32(b):
+    return int.from_bytes(b[:4], "little")
+
+
+def key(name):
+    # Must match okx_fixed_lookup() below.
+    b = name.encode()
+    return (load32(b) ^ ((load32(b[-4:]) * 31) & MASK32) ^ len(b)) & MASK32
+
+
+def slot(k, seed, n):
+    return (((k * seed) & MASK32) * n) >> 32
+
+
+def find_seed(names):
+    keys = [key(s) for s in names]
+    n = len(names)
+    seed = 0x9E3779B1
+    for _ in range(1 << 24):
+        if len({slot(k, seed, n) for k in keys}) == n:
+            return seed
+        seed = (seed * 1103515245 + 12345) & MASK32 | 1
+    sys.exit("gen_symbols.py: no perfect hash seed found")
+
+
+def main():
+    specs = []
+    for arg in sys.argv[1:] or DEFAULT_SYMBOLS:
+        name, price_dec, size_dec = arg.split(":")
+        if not 4 <= len(name) <= 15:
+            sys.exit("gen_symbols.py: instId length must be 4..15: " + name)
+        specs.append((name, int(price_dec), int(size_dec)))
+    if len({s[0] for s in specs}) != len(specs):
+        sys.exit("gen_symbols.py: duplicate instId")
+
+    n = len(specs)
+    seed = find_seed([s[0] for s in specs])
+    specs.sort(key=lambda s: slot(key(s[0]), seed, n))
+
+    out = sys.stdout
+    out.write("// Generated by gen_symbols.py -- do not edit.\n")
+    out.write("// " + " ".join("%s:%d:%d" % s for s in specs) + "\n")
+    out.write("#ifndef OKX_SYMBOLS_H\n#define OKX_SYMBOLS_H\n\n")
+    out.write("#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__\n")
+    out.write("#error \"okx_symbols.h hash assumes a little-endian target\"\n#endif\n\n")
+    out.write("// X(id, instId, price_decimals, size_decimals), in id order.\n")
+    out.write("#define OKX_SYMBOLS(X) \\\n")
+    out.write(" \\\n".join('    X(%d, "%s", %d, %d)' % (i, s[0], s[1], s[2])
+                          for i, s in enumerate(specs)))
+    out.write("\n\n#define OKX_NUM_SYMBOLS %d\n\n" % n)
+    out.write("#define OKX_SYMBOL_NAME(id, name, pd, sd) name,\n")
+    out.write("static const char okx_symbol_name[OKX_NUM_SYMBOLS][16] = { OKX_SYMBOLS(OKX_SYMBOL_NAME) };\n")
+    out.write("#undef OKX_SYMBOL_NAME\n")
+    out.write("#define OKX_SYMBOL_LEN(id, name, pd, sd) sizeof(name) - 1,\n")
+    out.write("static const uint8_t okx_symbol_len[OKX_NUM_SYMBOLS] = { OKX_SYMBOLS(OKX_SYMBOL_LEN) };\n")
+    out.write("#undef OKX_SYMBOL_LEN\n\n")
+    out.write("// Minimal perfect hash: every configured instId maps to its own id.\n")
+    out.write("static inline uint16_t okx_fixed_lookup(const char *s, size_t len) {\n")
+    out.write("    uint32_t a, b;\n")
+    out.write("    if (len < 4 || len > 15)\n        return 0xFFFF;\n")
+    out.write("    memcpy(&a, s, 4);\n    memcpy(&b, s + len - 4, 4);\n")
+    out.write("    uint32_t k = a ^ (b * 31u) ^ (uint32_t)len;\n")
+    out.write("    uint32_t id = (uint32_t)(((uint64_t)(k * 0x%08Xu) * OKX_NUM_SYMBOLS) >> 32);\n" % seed)
+    out.write("    if (len != okx_symbol_len[id] || memcmp(s, okx_symbol_name[id], len) != 0)\n")
+    out.write("        return 0xFFFF;\n    return (uint16_t)id;\n}\n\n")
+    out.write("#endif // OKX_SYMBOLS_H\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,296 @@
+#!/usr/bin/env python3
+"""Local stand-in for the OKX public websocket, for measuring okx_client without the exchange.
+
+Usage: ./mock_okx.py [--port 8443] [--rate N] [--seconds S] [--drop-every S]
+                     [--silence-every S] [--jitter-ms J] [--universe N] [--cert FILE --key FILE]
+       ./okx_client --server localhost:8443 [--discover https://localhost:8443/api/v5/public/instruments] ...
+
+Serves wss:// (TLS with a self-signed certificate generated by the openssl CLI unless
+--cert/--key are given) on /ws/v5/public. After a "subscribe" op it pushes tickers (or
+trades) frames in the OKX format for every subscribed instId, N per second per
+instrument, with a random walk price, until an "unsubscribe" op for it. The updates
+come from one shared stream, so every connection subscribed to an instrument receives
+the same frames (same ts), each copy delayed by a random 0..J ms with --jitter-ms to let
+a --dual-feed client's arbitration pick different winners. A text "ping" is answered
+with "pong". On exit it prints how many frames each connection was sent, so the
+client's per-message figures can be checked.
+--drop-every S aborts the oldest open connection every S seconds, to measure how long the
+client's feed stays dark across a reconnect (or a standby promotion). --silence-every S
+instead stops all traffic on the oldest connection, pongs included, but leaves the socket
+open, the way a half-open connection looks to the client.
+Plain GET requests (no websocket upgrade) are answered like the OKX REST API for
+/api/v5/public/instruments?instType=SPOT and /api/v5/market/tickers?instType=SPOT, listing
+the START_PRICES instruments, or with --universe N that many synthetic T0001-USDT... spot
+pairs of falling 24h turnover, plus a few non-USDT and suspended ones the client must skip.
+"""
+import argparse
+import asyncio
+import base64
+import hashlib
+import json
+import os
+import random
+import ssl
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+WS_GUID = b"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+START_PRICES = {
+    "BTC-USDT": 43251.7, "ADA-USDT": 0.3821, "ETH-USDT": 2287.45, "DOGE-USDT": 0.08123,
+    "XRP-USDT": 0.5234, "SOL-USDT": 101.27, "LTC-USDT": 71.42, "BNB-USDT": 312.8,
+}
+
+
+def self_signed_cert(directory):
+    cert = os.path.join(directory, "mock_okx.crt")
+    key = os.path.join(directory, "mock_okx.key")
+    subprocess.run(["openssl", "req", "-x509", "-newkey", "rsa:2048", "-nodes", "-days", "1",
+                    "-subj", "/CN=localhost", "-keyout", key, "-out", cert],
+                   check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    return cert, key
+
+
+def ws_frame(payload, opcode=0x1):
+    n = len(payload)
+    if n < 126:
+        header = struct.pack("!BB", 0x80 | opcode, n)
+    elif n < 65536:
+        header = struct.pack("!BBH", 0x80 | opcode, 126, n)
+    else:
+        header = struct.pack("!BBQ", 0x80 | opcode, 127, n)
+    return header + payload
+
+
+async def read_frame(reader):
+    b0, b1 = await reader.readexactly(2)
+    n = b1 & 0x7F
+    if n == 126:
+        n = struct.unpack("!H", await reader.readexactly(2))[0]
+    elif n == 127:
+        n = struct.unpack("!Q", await reader.readexactly(8))[0]
+    mask = await reader.readexactly(4) if b1 & 0x80 else b"\0\0\0\0"
+    data = bytearray(await reader.readexactly(n))
+    for i in range(n):
+        data[i] ^= mask[i % 4]
+    return b0 & 0x0F, bytes(data)
+
+
+def universe(args):
+    # (instId, quoteCcy, state, tickSz, lotSz, volCcy24h)
+    if args.universe <= 0:
+        return [(inst_id, "USDT", "live", "0.1" if price > 1000 else "0.01" if price > 10 else "0.00001",
+                 "0.000001", "%.2f" % (1e9 / (i + 1))) for i, (inst_id, price) in enumerate(START_PRICES.items())]
+    listing = [("T%04d-USDT" % (i + 1), "USDT", "live", "0.0001", "0.01", "%.2f" % (2e8 / (i + 1)))
+               for i in range(args.universe)]
+    return listing + [("T0001-BTC", "BTC", "live", "0.00000001", "0.01", "1000.00"),
+                      ("T0001-USDC", "USDC", "live", "0.0001", "0.01", "1000.00"),
+                      ("HALT-USDT", "USDT", "suspend", "0.0001", "0.01", "0.00")]
+
+
+def rest_response(args, path):
+    if path.startswith("/api/v5/public/instruments"):
+        data = [{"instType": "SPOT", "instId": i, "baseCcy": i.split("-")[0], "quoteCcy": q,
+                 "state": state, "tickSz": tick, "lotSz": lot, "minSz": lot}
+                for i, q, state, tick, lot, _ in universe(args)]
+    elif path.startswith("/api/v5/market/tickers"):
+        ts = str(int(time.time() * 1000))
+        data = [{"instType": "SPOT", "instId": i, "last": "1", "volCcy24h": volume, "ts": ts}
+                for i, _, _, _, _, volume in universe(args)]
+    else:
+        return b"HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n"
+    body = json.dumps({"code": "0", "msg": "", "data": data}, separators=(",", ":")).encode()
+    return (b"HTTP/1.0 200 OK\r\nContent-Type: application/json\r\nContent-Length: %d\r\n\r\n"
+            % len(body)) + body
+
+
+def update(channel, inst_id, price, size, trade_id):
+    ts = str(int(time.time() * 1000))
+    if channel == "trades":
+        data = {"instId": inst_id, "tradeId": str(trade_id), "px": "%.8g" % price,
+                "sz": "%.6f" % size, "side": random.choice(("buy", "sell")), "ts": ts}
+    else:
+        data = {"instType": "SPOT", "instId": inst_id, "last": "%.8g" % price,
+                "lastSz": "%.6f" % size, "vol": "%.6f" % size, "ts": ts}
+    return json.dumps({"arg": {"channel": channel, "instId": inst_id}, "data": [data]},
+                      separators=(",", ":")).encode()
+
+
+class Connection:
+    def __init__(self, args, number, reader, writer):
+        self.args = args
+        self.number = number
+        self.reader = reader
+        self.writer = writer
+        self.subscribed = {}  # instId -> channel
+        self.sent = 0
+        self.queue = asyncio.Queue()
+        self.silent = False
+
+    async def handshake(self):
+        # Returns False after answering a plain (REST) GET instead.
+        request = await self.reader.readuntil(b"\r\n\r\n")
+        if b"upgrade: websocket" not in request.lower():
+            path = request.split(b" ")[1].decode() if request.count(b" ") >= 2 else "/"
+            self.writer.write(rest_response(self.args, path))
+            await self.writer.drain()
+            return False
+        key = b""
+        for line in request.split(b"\r\n"):
+            if line.lower().startswith(b"sec-websocket-key:"):
+                key = line.split(b":", 1)[1].strip()
+        accept = base64.b64encode(hashlib.sha1(key + WS_GUID).digest())
+        self.writer.write(b"HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+                          b"Connection: Upgrade\r\nSec-WebSocket-Accept: " + accept + b"\r\n\r\n")
+        await self.writer.drain()
+        return True
+
+    async def send(self, payload, opcode=0x1):
+        if self.silent:
+            return
+        self.writer.write(ws_frame(payload, opcode))
+        await self.writer.drain()
+
+    async def push_tickers(self):
+        while True:
+            await self.send(await self.queue.get())
+            self.sent += not self.silent
+
+    async def serve(self):
+        if not await self.handshake():
+            return
+        pusher = asyncio.ensure_future(self.push_tickers())
+        try:
+            while True:
+                opcode, data = await read_frame(self.reader)
+                if opcode == 0x8:      # Close
+                    break
+                if opcode == 0x9:      # Websocket ping
+                    await self.send(data, 0xA)
+                elif data == b"ping":  # OKX text keepalive
+                    await self.send(b"pong")
+                elif opcode == 0x1:
+                    for reply in self.on_request(json.loads(data)):
+                        await self.send(json.dumps(reply, separators=(",", ":")).encode())
+        finally:
+            pusher.cancel()
+
+    def on_request(self, request):
+        # One event per argument, as OKX acknowledges subscriptions.
+        op = request.get("op")
+        for arg in request.get("args", []):
+            inst_id = arg.get("instId")
+            if op == "subscribe":
+                self.subscribed[inst_id] = arg.get("channel", "tickers")
+            elif op == "unsubscribe" and self.subscribed.get(inst_id) == arg.get("channel", "tickers"):
+                del self.subscribed[inst_id]
+            yield {"event": op, "arg": arg}
+
+
+async def publish(args, connections):
+    # One update per subscribed instrument and interval, fanned out to every subscriber.
+    loop = asyncio.get_running_loop()
+    prices = {}
+    trade_id = 0
+    interval = 1.0 / args.rate
+    next_time = time.monotonic()
+    while True:
+        for inst_id in sorted({i for c in connections for i in c.subscribed}):
+            price = prices.get(inst_id, START_PRICES.get(inst_id, 100.0))
+            prices[inst_id] = price * (1 + random.gauss(0, 1e-4))
+            size = random.uniform(0.001, 5)
+            trade_id += 1
+            frames = {}  # One frame per channel, shared by its subscribers
+            for conn in connections:
+                channel = conn.subscribed.get(inst_id)
+                if channel is None:
+                    continue
+                if channel not in frames:
+                    frames[channel] = update(channel, inst_id, prices[inst_id], size, trade_id)
+                frame = frames[channel]
+                if args.jitter_ms > 0:
+                    loop.call_later(random.uniform(0, args.jitter_ms) / 1e3, conn.queue.put_nowait, frame)
+                else:
+                    conn.queue.put_nowait(frame)
+        next_time += interval
+        await asyncio.sleep(max(0.0, next_time - time.monotonic()))
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--port", type=int, default=8443)
+    parser.add_argument("--rate", type=float, default=10, help="frames per second per instrument")
+    parser.add_argument("--seconds", type=float, default=0, help="stop after S seconds (0: run until ^C)")
+    parser.add_argument("--drop-every", type=float, default=0, help="abort the oldest connection every S seconds")
+    parser.add_argument("--silence-every", type=float, default=0,
+                        help="stop all traffic on the oldest connection every S seconds")
+    parser.add_argument("--jitter-ms", type=float, default=0, help="random delay of each connection's copy")
+    parser.add_argument("--universe", type=int, default=0,
+                        help="list N synthetic USDT spot instruments on the REST endpoints")
+    parser.add_argument("--cert")
+    parser.add_argument("--key")
+    args = parser.parse_args()
+
+    context = ssl.create_default_context(ssl.Purpose.CLIENT_AUTH)
+    with tempfile.TemporaryDirectory() as directory:
+        cert, key = (args.cert, args.key) if args.cert else self_signed_cert(directory)
+        context.load_cert_chain(cert, key)
+
+    connections = []
+    open_connections = []
+
+    async def drop_connections():
+        while True:
+            await asyncio.sleep(args.drop_every)
+            if open_connections:
+                conn = open_connections.pop(0)
+                print("[mock_okx] dropping connection %d" % conn.number, file=sys.stderr)
+                conn.writer.transport.abort()
+
+    async def silence_connections():
+        while True:
+            await asyncio.sleep(args.silence_every)
+            live = [c for c in open_connections if not c.silent]
+            if live:
+                print("[mock_okx] silencing connection %d" % live[0].number, file=sys.stderr)
+                live[0].silent = True
+
+    async def on_connect(reader, writer):
+        conn = Connection(args, len(connections) + 1, reader, writer)
+        connections.append(conn)
+        open_connections.append(conn)
+        print("[mock_okx] connection %d from %s" % (conn.number, writer.get_extra_info("peername")[0]),
+              file=sys.stderr)
+        try:
+            await conn.serve()
+        except (asyncio.IncompleteReadError, ConnectionError, ssl.SSLError):
+            pass
+        finally:
+            if conn in open_connections:
+                open_connections.remove(conn)
+            writer.close()
+            print("[mock_okx] connection %d closed, %d frames sent" % (conn.number, conn.sent),
+                  file=sys.stderr)
+
+    server = await asyncio.start_server(on_connect, "0.0.0.0", args.port, ssl=context)
+    print("[mock_okx] listening on wss://localhost:%d/ws/v5/public" % args.port, file=sys.stderr)
+    asyncio.ensure_future(publish(args, open_connections))
+    if args.drop_every > 0:
+        asyncio.ensure_future(drop_connections())
+    if args.silence_every > 0:
+        asyncio.ensure_future(silence_connections())
+    async with server:
+        if args.seconds > 0:
+            await asyncio.sleep(args.seconds)
+        else:
+            await server.serve_forever()
+    print("[mock_okx] %d frames sent" % sum(c.sent for c in connections), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
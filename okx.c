@@ -1,15 +1,48 @@
+#define _GNU_SOURCE         // fallocate()
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
 #include <libwebsockets.h>
+#include <openssl/ssl.h>
 #include <jansson.h>
 #include <time.h>
 #include <math.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <linux/io_uring.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <ctype.h>
+#include <sys/resource.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <zlib.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+
+// Fixed-universe build (-DOKX_FIXED_UNIVERSE): the symbol list and its perfect hash are
+// generated at build time by gen_symbols.py into okx_symbols.h.
+#ifdef OKX_FIXED_UNIVERSE
+#include "okx_symbols.h"
+#endif
+#include "okx_journal.h"
 
 // --------------------- Color Macros ---------------------
 #define KGRN "\033[0;32m"    // Green
@@ -22,24 +55,206 @@
 
 // --------------------- Configuration Constants ---------------------
 #define TRADE_BUFFER_SIZE 100000  // Maximum trades stored per symbol (15-minute window)
+#define TRADE_HEAD_SIZE 1024      // Uncompressed head of a compressed window (--window compressed)
+#define TRADE_MIN_CAPACITY 256    // Smallest window (or head) allocated for a quiet instrument
+#define TICKER_MAX_PER_WINDOW 9000  // tickers pushes at most every 100 ms: 9000 per 15 minutes
+#define INDEX_STRIDE 64           // CSV rows between two entries of the sparse .idx time index
+#define ARROW_META_SIZE 4096      // Flatbuffer metadata reserved per Arrow IPC message
+#define ARROW_ROW_BYTES 160       // Upper bound of Arrow record batch body bytes per instrument
+#define ARROW_MAX_CLIENTS 8       // Consumers served on the --arrow unix: socket
 #define MA_HISTORY_SIZE 8         // Number of moving average records (one per minute)
 #define FIFTEEN_MINUTES (15 * 60)
-#define MAX_INSTRUMENTS 8         // Exactly the required 8 symbols
+#ifdef OKX_FIXED_UNIVERSE
+#define MAX_INSTRUMENTS OKX_NUM_SYMBOLS  // Storage sized exactly for the generated symbol list
+#else
+#define MAX_INSTRUMENTS 1024      // Room for a discovered universe (--discover) or --control additions
+#endif
+#define PRICE_DECIMALS_DEFAULT 8  // Fixed-point decimals for prices of unknown instruments
+#define SIZE_DECIMALS_DEFAULT 8   // Fixed-point decimals for sizes of unknown instruments
+#define MAX_DECIMALS 18           // Largest supported fixed-point scale (10^18 fits in int64)
+#define INTERN_TABLE_SIZE 2048    // Open-addressing slots for instId interning (power of two)
+#define INST_ID_NONE 0xFFFF       // Id returned for instIds that were never subscribed
+#define CACHE_LINE_SIZE 64        // Alignment unit used to keep threads off each other's lines
+#define CACHE_ALIGNED __attribute__((aligned(CACHE_LINE_SIZE)))
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)  // Huge page size on x86-64 and AArch64 (4K granule)
+#define OUT_BUFFER_SIZE (64 * 1024)       // Staging buffer per output file
+#define OUT_BUFFER_MIN (4 * 1024)         // Staging buffer of the files of the quietest instruments
+#define OUT_FLUSH_INTERVAL_MS 100         // Period of the batched output flush
+#define OUT_PREALLOC_CHUNK (1024 * 1024)  // Output files are preallocated in steps of this size
+#define URING_ENTRIES 64                  // Submission queue depth of the output io_uring
+#define DURABILITY_PERIOD_MS 5000         // fsync interval of --durability periodic
+#define COMPRESS_CHUNK (64 * 1024)        // Read size when gzipping a closed segment
+#define LATENCY_SUB_BITS 3                // Log-linear latency histograms: 8 sub-buckets per power of two
+#define LATENCY_MAX_BITS 40               // Latencies of 2^40 ns (~18 minutes) or more share the last bucket
+#define RECONNECT_BASE_MS 100             // First backoff step after a failed reconnect
+#define RECONNECT_MAX_MS 10000            // Backoff ceiling between reconnect attempts
+#define TLS_SESSION_TIMEOUT_S 3600        // Lifetime of cached TLS client sessions
+#define PING_IDLE_MS 5000                 // Send a text "ping" after this long without any frame
+#define PONG_TIMEOUT_MS 3000              // Reconnect if nothing arrives this long after a ping
+#define STALE_FACTOR 10                   // Instrument stale after 10x its usual tick interval...
+#define STALE_MIN_S 5                     // ...but never before 5 s of silence
+#define STALE_RECONNECT_S 30              // Minimum spacing of reconnects for an all-silent feed
+#define CONTROL_LINE_MAX 256              // Longest command line accepted on the --control socket
+#define DISCOVERY_URL "https://www.okx.com/api/v5/public/instruments?instType=SPOT"
+#define DISCOVERY_TICKERS_PATH "/api/v5/market/tickers?instType=SPOT"  // 24h turnover, same host
+#define DISCOVERY_BUSY_TURNOVER 5e7       // 24h USDT turnover of an instrument pushing every 100 ms
+#define DISCOVERY_MAX_BYTES (16 * 1024 * 1024)  // Largest REST response accepted
+#define SUBSCRIBE_MAX_BYTES 4096          // Length of one subscribe request (OKX accepts 64 KB)
+#define INSTRUMENTS_PER_CONN 100          // Subscriptions carried by one websocket connection
+#define WS_MAX_SHARDS ((MAX_INSTRUMENTS + INSTRUMENTS_PER_CONN - 1) / INSTRUMENTS_PER_CONN)
+#define CONNECT_SPACING_MS 350            // OKX accepts 3 new connections per second and IP
+#define BENCH_POLL_SECONDS 5              // Duration of each mode in --bench-busy-poll
+#define BENCH_POLL_INTERVAL_US 1000       // Gap between two messages in --bench-busy-poll
+#define REPLAY_MINUTE_PASSES (MA_HISTORY_SIZE + 2)  // Minute passes run during a replay
+
+// --------------------- Function Multiversioning ---------------------
+// Hot kernels (window sums, Pearson correlation) are written as
+// always-inline *_impl functions and exported through MULTIVERSION, which compiles one
+// clone per ISA level into the same binary and selects one when the program is loaded:
+//   x86-64:  AVX2 and baseline SSE2 clones (target_clones).
+//   AArch64: SVE and baseline NEON clones (target_clones, GCC >= 14 only).
+//   ARMv7:   NEON and VFP-only clones, picked from the kernel's HWCAP via an ifunc.
+// Define OKX_NO_MULTIVERSION to build a single plain version of every kernel.
+#define KERNEL_IMPL static inline __attribute__((always_inline))
+
+#if defined(OKX_NO_MULTIVERSION) || !defined(__GNUC__) || defined(__clang__)
+#define MULTIVERSION(ret, name, params, args) \
+    ret name params { return name##_impl args; }
+#elif defined(__x86_64__)
+#define MULTIVERSION(ret, name, params, args) \
+    __attribute__((target_clones("avx2", "default"))) ret name params { return name##_impl args; }
+#elif defined(__aarch64__) && __GNUC__ >= 14
+#define MULTIVERSION(ret, name, params, args) \
+    __attribute__((target_clones("sve", "default"))) ret name params { return name##_impl args; }
+#elif defined(__arm__) && !defined(__ARM_NEON)
+#define OKX_HWCAP_NEON (1 << 12)  // HWCAP_NEON from <asm/hwcap.h>
+#define MULTIVERSION(ret, name, params, args) \
+    static ret name##_vfp params { return name##_impl args; } \
+    __attribute__((target("fpu=neon-vfpv4"))) static ret name##_neon params { return name##_impl args; } \
+    static ret (*name##_resolve(unsigned long hwcap)) params { \
+        return (hwcap & OKX_HWCAP_NEON) ? name##_neon : name##_vfp; \
+    } \
+    ret name params __attribute__((ifunc(#name "_resolve")));
+#else
+#define MULTIVERSION(ret, name, params, args) \
+    ret name params { return name##_impl args; }
+#endif
 
 // --------------------- Global Log Files ---------------------
-FILE *timing_file = NULL;    // Logs scheduled vs. actual start time differences
-FILE *cpu_idle_file = NULL;  // Logs CPU idle percentage
+typedef struct out_file out_file_t;  // Buffered output file, see "Output Writer"
+
+out_file_t *timing_file = NULL;    // Logs scheduled vs. actual start time differences
+out_file_t *cpu_idle_file = NULL;  // Logs CPU idle percentage
+out_file_t *record_file = NULL;    // Raw received frames (--record), one per line
+out_file_t *latency_file = NULL;   // Per-minute receive latency percentiles (--rx-timestamps)
+
+// --------------------- Command-Line Options ---------------------
+// Backing for large buffers (trade windows, correlation input).
+typedef enum {
+    HUGEPAGES_OFF,       // Regular 4 KB pages
+    HUGEPAGES_THP,       // Transparent huge pages requested with madvise(MADV_HUGEPAGE)
+    HUGEPAGES_EXPLICIT   // Preallocated hugetlbfs pages (MAP_HUGETLB), falling back to THP
+} hugepages_mode_t;
+
+// How output rows reach the disk.
+typedef enum {
+    OUTPUT_SYNC,      // One write per row, as soon as it is produced
+    OUTPUT_WRITEV,    // Rows batched per file, one pwritev per file and flush interval
+    OUTPUT_IO_URING   // Rows batched, all files submitted in one io_uring_enter per interval
+} output_backend_t;
+
+// When output rows are forced to stable storage.
+typedef enum {
+    DURABILITY_NONE,      // Never: rows reach the page cache only
+    DURABILITY_PERIODIC,  // fsync every DURABILITY_PERIOD_MS
+    DURABILITY_GROUP,     // Group commit: fdatasync together with each flush (--commit-ms)
+    DURABILITY_MINUTE     // fdatasync after each minute pass
+} durability_t;
+
+// Time-based rotation of the output files.
+typedef enum {
+    ROTATE_NONE,
+    ROTATE_DAILY,   // Segments named <file>-YYYYMMDD.<ext>.gz
+    ROTATE_HOURLY   // Segments named <file>-YYYYMMDDHH.<ext>.gz
+} rotate_t;
+
+// Storage of the 15-minute trade windows.
+typedef enum {
+    WINDOW_FLAT,        // One uncompressed trade_t array per instrument
+    WINDOW_COMPRESSED   // Uncompressed head plus sealed compressed blocks (okx_journal.h)
+} window_mode_t;
+
+// Handling of pushes repeating an instrument's previous last price and size (and tradeId).
+typedef enum {
+    DEDUP_OFF,    // Stored like any other push
+    DEDUP_DROP,   // Counted, then dropped before the window and transactions.csv
+    DEDUP_MARK    // Stored, with Repeat=1 in transactions.csv
+} dedup_mode_t;
+
+typedef struct {
+    const char *record_path;  // --record FILE: append every received frame to FILE
+    const char *replay_path;  // --replay FILE: process a recorded feed instead of connecting
+    int replay_loops;         // --replay-loops N: feed the recording N times
+    hugepages_mode_t hugepages;  // --hugepages off|thp|explicit
+    output_backend_t output;     // --output sync|writev|io_uring
+    durability_t durability;     // --durability none|periodic|group|minute
+    int commit_ms;               // --commit-ms N: flush (and group commit) interval
+    rotate_t rotate;             // --rotate none|daily|hourly
+    window_mode_t window;        // --window flat|compressed
+    const char *arrow_path;      // --arrow FILE|unix:PATH: Arrow IPC stream of minute results
+    int rx_timestamps;           // --rx-timestamps: kernel receive timestamps (SO_TIMESTAMPING)
+    int busy_poll_cpu;           // --busy-poll CPU: pin the network thread to CPU and spin (-1: off)
+    int busy_poll_us;            // --busy-poll-us N: SO_BUSY_POLL budget of the websocket socket
+    const char *server_host;     // --server HOST:PORT: connect there instead of OKX (mock_okx.py)
+    int server_port;
+    int insecure;                // --insecure: accept any certificate, also from non-loopback servers
+    int tcp_nodelay;             // --tcp-nodelay: disable Nagle on the websocket socket
+    int rcvbuf;                  // --rcvbuf BYTES: SO_RCVBUF of the websocket socket (0: kernel default)
+    int quickack;                // --quickack: re-arm TCP_QUICKACK after every received frame
+    int ktls;                    // --ktls: kernel TLS receive offload where OpenSSL and the kernel allow
+    int standby;                 // --standby: keep a second, subscribed connection ready to take over
+    int dual_feed;               // --dual-feed: two live connections, first arrival of each update wins
+    const char *control_path;    // --control PATH: Unix socket taking add/remove/list commands
+    const char *discover;        // --discover okx|URL|FILE: subscribe to every live USDT spot instrument
+    int conflate;                // --conflate: store frames on an ingest thread, latest per instrument
+    dedup_mode_t dedup_tickers;  // --dedup [tickers=]off|drop|mark: repeated tickers pushes
+    dedup_mode_t dedup_trades;   // --dedup trades=off|drop|mark: repeated trades pushes (same tradeId)
+} options_t;
+
+static options_t options = { NULL, NULL, 1, HUGEPAGES_OFF, OUTPUT_IO_URING,
+                             DURABILITY_NONE, OUT_FLUSH_INTERVAL_MS, ROTATE_DAILY, WINDOW_COMPRESSED,
+                             NULL, 0, -1, 0, "ws.okx.com", 8443, 0, 0, 0, 0, 0, 0, 0, NULL, NULL, 0, DEDUP_OFF, DEDUP_OFF };
+
+// Repeat handling of the pushes of a channel ("tickers" or "trades").
+static dedup_mode_t channel_dedup(const char *channel) {
+    return strcmp(channel, "trades") == 0 ? options.dedup_trades : options.dedup_tickers;
+}
+
+// Whether transactions.csv carries the Repeat column (some channel is marked).
+static inline int dedup_marking(void) {
+    return options.dedup_tickers == DEDUP_MARK || options.dedup_trades == DEDUP_MARK;
+}
 
 // --------------------- Data Structures ---------------------
 
 // Trade structure with high-resolution timestamp (in seconds).
+// Price and volume are fixed-point integers scaled by the instrument's tick/lot decimals.
 typedef struct {
     double timestamp;
-    double price;
-    double volume;
+    int64_t price;
+    int64_t volume;
     double delay;
 } trade_t;
 
+// Accumulator for sums of fixed-point values (100000 trades of a 24h volume overflow int64).
+// Targets without __int128 (armv7) sum in a double: it cannot overflow, and only rounds
+// once the sum passes 2^53.
+#ifdef __SIZEOF_INT128__
+typedef __int128 fx_sum_t;
+#else
+typedef double fx_sum_t;
+#endif
+
 // Moving average record computed every minute.
 typedef struct {
     double timestamp;           // Computation time
@@ -47,31 +262,125 @@ typedef struct {
     double total_volume;        // Total volume over last 15 minutes
     double avg_delay;           // Average processing delay for trades
     double avg_scheduled_delay; // Average scheduled delay for trades
+    int stale;                  // No trade in the window: moving_avg carried forward
 } ma_entry_t;
 
-// Instrument data structure.
+// Dense instrument id assigned when the symbol is interned at subscription time.
+typedef uint16_t inst_id_t;
+
+// Per-instrument state is split three ways (all indexed by inst_id_t):
+//   inst_hot[]    - counters and latest values touched on every tick, one cache line each
+//                   so threads updating different instruments never share a line;
+//   instruments[] - cold metadata (name, output files) and per-minute results;
+//   inst_trades[] - the bulk 15-minute trade windows, allocated separately. In compressed
+//                   mode this is only the newest TRADE_HEAD_SIZE trades; older ones live
+//                   in the instrument's chain of trade_block_t.
+
+// A sealed, compressed run of trades with its precomputed sums, so that the minute pass
+// only decodes a block when it straddles the window start.
+typedef struct trade_block {
+    struct trade_block *next;
+    double min_ts, max_ts;      // Arrival times of the first and last trade
+    fx_sum_t sum_price;
+    fx_sum_t sum_volume;
+    double sum_delay;
+    int expired;                // Leading trades already out of the window (not in block_trades)
+    journal_block_hdr_t hdr;    // Also the journal record header
+    uint8_t data[];             // Encoded trades (hdr.bytes)
+} trade_block_t;
+
+// Hot per-instrument state.
+typedef struct {
+    int trade_count;            // Trades currently stored in the window (head only if compressed)
+    int capacity;               // Length of inst_trades[id]
+    int block_trades;           // Trades held in compressed blocks and still in the window
+    int ma_count;               // Valid entries in ma_history
+    int price_decimals;         // Price scale: stored price = real price * 10^price_decimals
+    int size_decimals;          // Size scale: stored volume = real volume * 10^size_decimals
+    int64_t last_price;         // Latest trade price (fixed-point)
+    int64_t last_volume;        // Latest trade volume (fixed-point)
+    int64_t last_trade_id;      // tradeId of the latest trade (trades channel; 0 otherwise)
+    double last_trade_time;     // Arrival time of the latest trade, or of a dropped repeat of it
+    double tick_interval;       // Moving average of the time between trades (staleness check)
+    uint64_t ticks_total;       // Trades stored since startup
+    uint64_t repeats;           // Pushes repeating the latest trade, dropped or marked (--dedup)
+    dedup_mode_t dedup;         // Repeat handling of its channel
+    double max_corr;            // Maximum Pearson correlation (from MA vectors)
+    inst_id_t max_corr_id;      // Instrument achieving maximum correlation (INST_ID_NONE if none)
+} CACHE_ALIGNED inst_hot_t;
+
+// Lifecycle of an instrument slot. Slots added over --control are prepared off the
+// network thread, activated by it, and after removal retired and freed for reuse.
+typedef enum { INST_FREE, INST_PREPARING, INST_ACTIVE, INST_RETIRING } inst_state_t;
+
+// Cold per-instrument metadata and per-minute results.
 typedef struct {
     char instrument[16];
-    trade_t trades[TRADE_BUFFER_SIZE];
-    int trade_count;
+    size_t instrument_len;
+    inst_state_t state;         // Changed under ma_mutex; only INST_ACTIVE slots are interned
+    char channel[16];           // OKX channel subscribed to ("tickers" or "trades")
+    int shard;                  // Websocket connection (pair) carrying its subscription
     ma_entry_t ma_history[MA_HISTORY_SIZE];
-    int ma_count;
-    double max_corr;            // Maximum Pearson correlation (from MA vectors)
-    char max_corr_symbol[16];   // Symbol achieving maximum correlation
     double max_corr_time;       // Timestamp (current minute) when max correlation computed
     double max_corr_ma_time;    // Timestamp of the MA vector that resulted in max correlation
-    FILE *trans_file;           // Transactions log file
-    FILE *ma_file;              // Moving average log file
-    FILE *corr_file;            // Correlation log file
+    out_file_t *trans_file;     // Transactions log file
+    out_file_t *ma_file;        // Moving average log file
+    out_file_t *corr_file;      // Correlation log file
+    out_file_t *journal_file;   // Compressed trade journal (--window compressed)
+    out_file_t *trans_idx;      // Sparse time indexes (<file>.idx, see okx_journal.h)
+    out_file_t *ma_idx;
+    out_file_t *journal_idx;
+    uint64_t trans_rows;        // Rows written to the current transactions file
+    uint64_t ma_rows;
+    trade_block_t *blocks;      // Compressed part of the window, oldest first
+    trade_block_t *blocks_tail;
+    int block_count;
 } moving_avg_t;
 
+static inst_hot_t inst_hot[MAX_INSTRUMENTS];
 static moving_avg_t instruments[MAX_INSTRUMENTS];
-static int num_instruments = 0;
+static trade_t *inst_trades[MAX_INSTRUMENTS];
+static int trade_head_capacity = TRADE_BUFFER_SIZE;  // Default length of an inst_trades[] array
+static int num_instruments CACHE_ALIGNED = 0;
+
+#ifdef OKX_FIXED_UNIVERSE
+// Statically sized trade windows for the generated symbol list.
+static trade_t fixed_trade_storage[MAX_INSTRUMENTS][TRADE_BUFFER_SIZE] CACHE_ALIGNED;
+#endif
+
+#ifdef OKX_FIXED_UNIVERSE
+// Generated symbol list, already in id order.
+#define SUBSCRIBED_NAME(id, name, pd, sd) name,
+static const char *subscribed_symbols[] = { OKX_SYMBOLS(SUBSCRIBED_NAME) };
+#undef SUBSCRIBED_NAME
+
+// Every instrument is interned at startup, so per-minute loops run over a compile-time
+// constant and are fully unrolled.
+#define INSTRUMENT_COUNT OKX_NUM_SYMBOLS
+#define FOR_EACH_INSTRUMENT_UNROLL _Pragma("GCC unroll 16")
+#define INSTRUMENT_ACTIVE(id) 1
+#else
+// Instruments subscribed to on every connection; interned in this order (id 0..N-1).
+static const char *subscribed_symbols[] = {
+    "BTC-USDT", "ADA-USDT", "ETH-USDT", "DOGE-USDT",
+    "XRP-USDT", "SOL-USDT", "LTC-USDT", "BNB-USDT"
+};
+
+#define INSTRUMENT_COUNT num_instruments
+#define FOR_EACH_INSTRUMENT_UNROLL
+// Ids below num_instruments can be free or in transition after --control commands.
+#define INSTRUMENT_ACTIVE(id) (instruments[id].state == INST_ACTIVE)
+
+// instId -> id hash table; slots hold id + 1 so that zero marks an empty slot.
+static uint16_t intern_table[INTERN_TABLE_SIZE] CACHE_ALIGNED;
+#endif
+#define NUM_SUBSCRIBED (sizeof(subscribed_symbols) / sizeof(subscribed_symbols[0]))
 
 // --------------------- Global Flags ---------------------
-static int destroy_flag = 0;
-static int connection_flag = 0;
-static int writeable_flag = 0;
+// Each flag sits on its own cache line, away from the per-instrument state.
+static int destroy_flag CACHE_ALIGNED = 0;
+static int connection_flag CACHE_ALIGNED = 0;
+static int writeable_flag CACHE_ALIGNED = 0;
 
 // --------------------- Mutex ---------------------
 pthread_mutex_t ma_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -92,445 +401,3190 @@ void create_instrument_dir(const char *instr, char *dirpath, size_t size) {
     }
 }
 
-// Get or create an instrument entry.
-moving_avg_t* get_instrument(const char *instrument) {
-    for (int i = 0; i < num_instruments; i++) {
-        if (strcmp(instruments[i].instrument, instrument) == 0)
-            return &instruments[i];
-    }
-    if (num_instruments < MAX_INSTRUMENTS) {
-        moving_avg_t *inst = &instruments[num_instruments];
-        strncpy(inst->instrument, instrument, sizeof(inst->instrument) - 1);
-        inst->instrument[sizeof(inst->instrument) - 1] = '\0';
-        inst->trade_count = 0;
-        inst->ma_count = 0;
-        inst->max_corr = -2.0;
-        strcpy(inst->max_corr_symbol, "N/A");
-        inst->max_corr_time = 0;
-
-        char dirpath[128];
-        create_instrument_dir(instrument, dirpath, sizeof(dirpath));
-        char filename[256];
-
-        // Open transactions file.
-        snprintf(filename, sizeof(filename), "%s/transactions.csv", dirpath);
-        inst->trans_file = fopen(filename, "w");
-        if (inst->trans_file) {
-            fprintf(inst->trans_file, "Timestamp,Price,Volume,ProcessingDelay\n");
-            printf("[DEBUG] Opened transactions file: %s\n", filename);
-        } else {
-            printf("[ERROR] Could not open transactions file: %s\n", filename);
-        }
-
-        // Open moving average file.
-        snprintf(filename, sizeof(filename), "%s/moving_average.csv", dirpath);
-        inst->ma_file = fopen(filename, "w");
-        if (inst->ma_file) {
-            fprintf(inst->ma_file, "Timestamp,MovingAvg,TotalVolume,AvgProcessingDelay\n");
-            printf("[DEBUG] Opened moving average file: %s\n", filename);
-        } else {
-            printf("[ERROR] Could not open moving average file: %s\n", filename);
-        }
+// --------------------- Large Buffer Allocation ---------------------
+// Large, long-lived buffers are mapped directly and, depending on --hugepages, backed by
+// huge pages so that the per-minute scan over them needs far fewer TLB entries.
 
-        // Open correlation file.
-        snprintf(filename, sizeof(filename), "%s/correlation.csv", dirpath);
-        inst->corr_file = fopen(filename, "w");
-        if (inst->corr_file) {
-            fprintf(inst->corr_file, "Timestamp,OtherSymbol,Correlation,MaxCorrMATime\n");
-            printf("[DEBUG] Opened correlation file: %s\n", filename);
-        } else {
-            printf("[ERROR] Could not open correlation file: %s\n", filename);
-        }
+static size_t round_up_huge(size_t size) {
+    return (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+}
 
-        num_instruments++;
-        return inst;
-    }
-    fprintf(stderr, "Too many instruments!\n");
-    return NULL;
+// Ask for transparent huge pages on the 2 MB-aligned part of [ptr, ptr + size).
+static void advise_huge(void *ptr, size_t size) {
+    uintptr_t start = ((uintptr_t)ptr + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t)ptr + size) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+#ifdef MADV_HUGEPAGE
+    if (end > start && madvise((void *)start, end - start, MADV_HUGEPAGE) != 0)
+        printf(KRED "[Memory] madvise(MADV_HUGEPAGE) failed, using regular pages\n" RESET);
+#else
+    (void)start;
+    (void)end;
+#endif
 }
 
-// --------------------- Pearson Correlation Function ---------------------
-// Compute Pearson correlation coefficient for two vectors of length n.
-double pearson_corr_vector(const double *v1, const double *v2, int n) {
-    if (n < 2)
-        return NAN;
-    double sum1 = 0, sum2 = 0;
-    for (int i = 0; i < n; i++) {
-        sum1 += v1[i];
-        sum2 += v2[i];
-    }
-    double mean1 = sum1 / n;
-    double mean2 = sum2 / n;
-    double num = 0, den1 = 0, den2 = 0;
-    for (int i = 0; i < n; i++) {
-        double d1 = v1[i] - mean1;
-        double d2 = v2[i] - mean2;
-        num += d1 * d2;
-        den1 += d1 * d1;
-        den2 += d2 * d2;
+// Allocate a zeroed, 2 MB-aligned buffer of at least `size` bytes. Returns NULL on failure.
+void *big_alloc(size_t size) {
+    size_t len = round_up_huge(size);
+
+#ifdef MAP_HUGETLB
+    if (options.hugepages == HUGEPAGES_EXPLICIT) {
+        void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+            return p;
+        static int warned = 0;
+        if (!warned++)
+            printf(KRED "[Memory] MAP_HUGETLB failed (no reserved huge pages?), falling back to THP\n" RESET);
     }
-    if (den1 == 0 || den2 == 0)
-        return NAN;
-    return num / sqrt(den1 * den2);
-}
+#endif
 
-// --------------------- Data Structures for Correlation Computation ---------------------
-// This structure holds the most recent MA values and a mapping to the global instruments array.
-typedef struct {
-    int global_index;            // Index in the global instruments array.
-    char instrument[16];
-    ma_entry_t ma[MA_HISTORY_SIZE];
-} corr_data_t;
+    // Over-map by one huge page and trim so that the buffer starts on a 2 MB boundary.
+    size_t map_len = len + HUGE_PAGE_SIZE;
+    char *raw = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+        return NULL;
+    char *p = (char *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    if (p > raw)
+        munmap(raw, p - raw);
+    if (raw + map_len > p + len)
+        munmap(p + len, (raw + map_len) - (p + len));
 
-// Thread argument for correlation computation.
-typedef struct {
-    int index;          // Index in the corr_data_t array for which to compute correlation.
-    int total;          // Total number of instruments with complete MA history.
-    corr_data_t *data;  // Array of correlation data.
-    double current_time; // Current computation time.
-} corr_thread_arg_t;
+    if (options.hugepages != HUGEPAGES_OFF)
+        advise_huge(p, len);
+    return p;
+}
 
-// Thread function to compute correlations for one instrument.
-void *compute_corr_thread(void *arg) {
-    corr_thread_arg_t *ct_arg = (corr_thread_arg_t *)arg;
-    int idx = ct_arg->index;
-    int total = ct_arg->total;
-    double max_corr = -2.0;
-    char max_sym[16] = "N/A";
-    double max_ma_time = 0; // Timestamp of the MA value that maximizes the correlation
-    int max_ma_index = -1;  // Index of the MA value that maximizes the correlation
+// Release a buffer obtained from big_alloc with the same size.
+void big_free(void *ptr, size_t size) {
+    if (ptr)
+        munmap(ptr, round_up_huge(size));
+}
 
-    for (int j = 0; j < total; j++) {
-        if (j == idx)
-            continue;
+// Trade windows of a huge page or more come from big_alloc; the small windows of quiet
+// instruments come from the heap, so that a universe of hundreds does not map 2 MB each.
+static trade_t *window_alloc(int capacity) {
+    size_t size = (size_t)capacity * sizeof(trade_t);
+    if (size >= HUGE_PAGE_SIZE)
+        return big_alloc(size);
+    void *p = NULL;
+    return posix_memalign(&p, CACHE_LINE_SIZE, size) == 0 ? p : NULL;
+}
 
-        // Extract the moving average values for correlation computation
-        double ma1[MA_HISTORY_SIZE], ma2[MA_HISTORY_SIZE];
-        for (int k = 0; k < MA_HISTORY_SIZE; k++) {
-            ma1[k] = ct_arg->data[idx].ma[k].moving_avg;
-            ma2[k] = ct_arg->data[j].ma[k].moving_avg;
-        }
+static void window_free(trade_t *trades, int capacity) {
+    size_t size = (size_t)capacity * sizeof(trade_t);
+    if (size >= HUGE_PAGE_SIZE)
+        big_free(trades, size);
+    else
+        free(trades);
+}
 
-        // Compute Pearson correlation
-        double corr = pearson_corr_vector(ma1, ma2, MA_HISTORY_SIZE);
+// --------------------- Output Writer ---------------------
+// All CSV and binary logs go through out_file_t. Rows are appended to a per-file staging
+// buffer and a writer thread flushes every --commit-ms: the dirty buffers of all files are
+// submitted together, either as one io_uring submission or as one pwritev per file. Every
+// write targets an explicit offset inside space preallocated with fallocate, so the
+// filesystem does not extend the file on each append. The --durability policy decides
+// when written data is also synced, uniformly for all files.
+//
+// With --rotate, the writer thread closes every file when the day (or hour) changes: the
+// finished segment is renamed to <file>-<period>.<ext>, a fresh file with the same header
+// takes its place, and a low-priority thread syncs and gzips the segment in the
+// background. The --record file is never rotated, so that --replay (and build.sh pgo)
+// reads all of it.
 
-        // Update max correlation and corresponding timestamp
-        if (!isnan(corr) && corr > max_corr) {
-            max_corr = corr;
-            strncpy(max_sym, ct_arg->data[j].instrument, sizeof(max_sym) - 1);
-            max_sym[sizeof(max_sym) - 1] = '\0';
-
-            // Compute the mean of the MA vectors
-            double mean1 = 0, mean2 = 0;
-            for (int k = 0; k < MA_HISTORY_SIZE; k++) {
-                mean1 += ma1[k];
-                mean2 += ma2[k];
-            }
-            mean1 /= MA_HISTORY_SIZE;
-            mean2 /= MA_HISTORY_SIZE;
-
-            // Find the MA value that maximizes the correlation
-            double max_contrib = -1.0;
-            for (int k = 0; k < MA_HISTORY_SIZE; k++) {
-                double contrib = fabs((ma1[k] - mean1) * (ma2[k] - mean2));
-                if (contrib > max_contrib) {
-                    max_contrib = contrib;
-                    max_ma_index = k;
-                }
-            }
+struct out_file {
+    int fd;
+    char path[256];
+    pthread_mutex_t lock;
+    char *active;               // Rows appended since the last flush
+    size_t active_len;
+    size_t buf_size;            // Capacity of active and pending
+    char *pending;              // Buffer owned by the writer thread during a flush
+    size_t pending_len;
+    off_t pending_offset;
+    off_t offset;               // File offset of the next byte handed out
+    off_t allocated;            // End of the fallocate'd region
+    int unsynced;               // Data written since the last fsync/fdatasync
+    char *header;               // Rewritten at the top of every rotated file
+    size_t header_len;
+    int no_rotate;              // Kept as one file across periods (--record, read by --replay)
+    unsigned rotation;          // Last rotation that switched this file (writer thread)
+    struct out_file *next;
+};
 
-            // Store the timestamp of the MA value that maximizes the correlation
-            if (max_ma_index != -1) {
-                max_ma_time = ct_arg->data[idx].ma[max_ma_index].timestamp;
-            }
-        }
-    }
+// Counters reported by the replay benchmark.
+typedef struct {
+    uint64_t syscalls;          // write/pwritev/io_uring_enter/fallocate calls
+    uint64_t bytes;
+    uint64_t flushes;
+    uint64_t syncs;             // Files synced (fsync/fdatasync or IORING_OP_FSYNC)
+} out_stats_t;
 
-    // Update the corresponding global instrument using the stored global index
-    int global_idx = ct_arg->data[idx].global_index;
-    pthread_mutex_lock(&ma_mutex);
+// What out_flush_all does after writing.
+typedef enum { OUT_NO_SYNC, OUT_DATASYNC, OUT_FSYNC } out_sync_t;
 
-    strncpy(instruments[global_idx].max_corr_symbol, max_sym, sizeof(instruments[global_idx].max_corr_symbol) - 1);
-    instruments[global_idx].max_corr_symbol[sizeof(instruments[global_idx].max_corr_symbol) - 1] = '\0';
-    instruments[global_idx].max_corr = max_corr;
-    instruments[global_idx].max_corr_time = ct_arg->current_time; // Timestamp when max correlation was computed
-    instruments[global_idx].max_corr_ma_time = max_ma_time;      // Timestamp of the MA value that maximizes the correlation
+static out_stats_t out_stats;
+static out_file_t *out_files = NULL;       // Registry of open files
+static pthread_mutex_t out_files_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t out_thread;
+static int out_thread_running = 0;
+static volatile int out_thread_stop = 0;
 
-    // Log the correlation result
-    if (instruments[global_idx].corr_file) {
-        char timestamp[20];
-        time_t current_time = (time_t)ct_arg->current_time;
-        struct tm *tm_info = localtime(&current_time);
-        strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
+static const char *output_backend_names[] = { "sync", "writev", "io_uring" };
+static const char *durability_names[] = { "none", "periodic", "group", "minute" };
+static const char *rotate_names[] = { "none", "daily", "hourly" };
 
-        char ma_timestamp[20];
-        time_t ma_time = (time_t)max_ma_time;
-        struct tm *ma_tm_info = localtime(&ma_time);
-        strftime(ma_timestamp, sizeof(ma_timestamp), "%Y-%m-%d %H:%M:%S", ma_tm_info);
+// Closed segments waiting to be compressed. The descriptor of the segment is handed over
+// with it, and the compress thread trims and syncs it before gzipping the file.
+typedef struct compress_job {
+    char path[300];
+    int fd;                     // Still open on the segment (-1: already closed)
+    off_t length;               // Data length; preallocated space past it is trimmed
+    int trim;
+    struct compress_job *next;
+} compress_job_t;
 
-        fprintf(instruments[global_idx].corr_file, "%s,%s,%.4f,%s\n",
-                timestamp, // Timestamp when max correlation was computed
-                instruments[global_idx].max_corr_symbol,
-                instruments[global_idx].max_corr,
-                ma_timestamp); // Human-readable timestamp of the MA value
-        fflush(instruments[global_idx].corr_file);
-    }
+static compress_job_t *compress_queue = NULL;
+static pthread_mutex_t compress_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compress_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t compress_thread;
+static int compress_thread_running = 0;
+static int compress_stop = 0;
+static char out_period[16];               // Rotation period the open files belong to
+static unsigned out_rotation = 0;         // Rotations started (writer thread)
 
-    pthread_mutex_unlock(&ma_mutex);
-    free(ct_arg);
-    return NULL;
-}
+// Minimal io_uring used for batched writes (no liburing dependency).
+typedef struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+} uring_t;
 
-// --------------------- Trade Logging ---------------------
-// Parse JSON trade data, use clock_gettime for high-resolution timing, and log each trade.
-void save_trade(const char *json_str) {
-    json_t *root, *data_array, *data_obj, *price_obj, *vol_obj, *instId_obj;
-    json_error_t error;
+static uring_t out_ring = { .fd = -1 };
 
-    root = json_loads(json_str, 0, &error);
-    if (!root) {
-        fprintf(stderr, "JSON Parsing Error: %s\n", error.text);
-        return;
+static int uring_init(uring_t *ring, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0)
+        return -1;
+
+    ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_len > ring->sq_len)
+            ring->sq_len = ring->cq_len;
+        ring->cq_len = ring->sq_len;
     }
-    data_array = json_object_get(root, "data");
-    if (!json_is_array(data_array)) {
-        json_decref(root);
-        return;
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED)
+            goto fail;
     }
-    size_t index;
-    for (index = 0; index < json_array_size(data_array); index++) {
-        data_obj = json_array_get(data_array, index);
-        price_obj = json_object_get(data_obj, "last");
-        // Use "vol" if available; otherwise, fallback to "lastSz".
-        vol_obj = json_object_get(data_obj, "vol");
-        if (!vol_obj)
-            vol_obj = json_object_get(data_obj, "lastSz");
-        instId_obj = json_object_get(data_obj, "instId");
-        if (json_is_string(price_obj) && json_is_string(vol_obj) && json_is_string(instId_obj)) {
-            double price = atof(json_string_value(price_obj));
-            double vol = atof(json_string_value(vol_obj));
-            const char *inst = json_string_value(instId_obj);
-
-            struct timespec ts;
-            clock_gettime(CLOCK_REALTIME, &ts);
-            double now = ts.tv_sec + ts.tv_nsec / 1e9;
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        goto fail;
 
-            pthread_mutex_lock(&ma_mutex);
-            moving_avg_t *entry = get_instrument(inst);
-            if (entry && entry->trade_count < TRADE_BUFFER_SIZE) {
-                entry->trades[entry->trade_count].timestamp = now;
-                entry->trades[entry->trade_count].price = price;
-                entry->trades[entry->trade_count].volume = vol;
-            
-                // Compute processing delay.
-                struct timespec ts2;
-                clock_gettime(CLOCK_REALTIME, &ts2);
-                double current = ts2.tv_sec + ts2.tv_nsec / 1e9;
-                entry->trades[entry->trade_count].delay = current - now;
+    char *sq = ring->sq_ptr, *cq = ring->cq_ptr;
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
 
-                entry->trade_count++;
+fail:
+    close(ring->fd);
+    ring->fd = -1;
+    return -1;
+}
 
-                // Log the trade to the transactions file
-                if (entry->trans_file) {
-                    char timestamp[20];
-                    time_t trade_time = (time_t)now;
-                    struct tm *tm_info = localtime(&trade_time);
-                    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
+static void uring_destroy(uring_t *ring) {
+    if (ring->fd < 0)
+        return;
+    munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_len);
+    munmap(ring->sq_ptr, ring->sq_len);
+    close(ring->fd);
+    ring->fd = -1;
+}
 
-                    fprintf(entry->trans_file, "%s,%.2f,%.4f,%.9f\n",
-                            timestamp, price, vol, entry->trades[entry->trade_count].delay);
-                    fflush(entry->trans_file);
-                }
-            }
-            pthread_mutex_unlock(&ma_mutex);
-            printf(KYEL "[Transaction] %s - Price=%.2f, Vol=%.4f, Processing Delay=%.6f sec\n" RESET, inst, price, vol, entry->trades[entry->trade_count].delay);
+// Write all of buf at offset with plain pwrite calls (used for leftovers and sync mode).
+static void out_pwrite_all(out_file_t *f, const char *buf, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(f->fd, buf, len, offset);
+        __atomic_fetch_add(&out_stats.syscalls, 1, __ATOMIC_RELAXED);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "[ERROR] Write to %s failed: %s\n", f->path, strerror(errno));
+            return;
         }
+        __atomic_fetch_add(&out_stats.bytes, (uint64_t)n, __ATOMIC_RELAXED);
+        __atomic_store_n(&f->unsynced, 1, __ATOMIC_RELAXED);
+        buf += n;
+        len -= (size_t)n;
+        offset += n;
     }
-    json_decref(root);
-} 
-// --------------------- 15-Minute Moving Average & Volume Computation ---------------------
-// Compute average price, total volume, and average delay over trades in the last 15 minutes.
-void compute_moving_avg_and_volume(moving_avg_t *entry, double now, ma_entry_t *ma_out) {
-    double sum_price = 0, total_vol = 0, processing_delay_sum = 0;
-    int count = 0;
-    int new_trade_count = 0;
-    trade_t temp[TRADE_BUFFER_SIZE];
+}
 
-    for (int i = 0; i < entry->trade_count; i++) {
-        if (entry->trades[i].timestamp >= now - FIFTEEN_MINUTES) {
-            sum_price += entry->trades[i].price;
-            total_vol += entry->trades[i].volume;
-            processing_delay_sum += entry->trades[i].delay;
-            temp[new_trade_count++] = entry->trades[i];
-            count++;
+// Extend the preallocated region so that [offset, offset + len) is covered.
+static void out_preallocate(out_file_t *f, off_t offset, size_t len) {
+    if (offset + (off_t)len <= f->allocated)
+        return;
+    // Files with smaller staging buffers (quiet instruments) grow in proportionally smaller steps.
+    off_t chunk = (off_t)(OUT_PREALLOC_CHUNK / OUT_BUFFER_SIZE * f->buf_size);
+    off_t want = offset + (off_t)len - f->allocated;
+    want = (want + chunk - 1) / chunk * chunk;
+    __atomic_fetch_add(&out_stats.syscalls, 1, __ATOMIC_RELAXED);
+    if (fallocate(f->fd, FALLOC_FL_KEEP_SIZE, f->allocated, want) == 0)
+        f->allocated += want;
+    else
+        f->allocated = offset + (off_t)len;  // Unsupported (e.g. tmpfs): just write.
+}
 
-        }
+// Reap the completions of the current chunk that are ready, first waiting for one if
+// `wait` is set. Write sizes and fsync results are recorded by tag. Returns the number reaped.
+static int uring_reap(int count, size_t *done, int *synced, int wait) {
+    if (wait) {
+        syscall(__NR_io_uring_enter, out_ring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        __atomic_fetch_add(&out_stats.syscalls, 1, __ATOMIC_RELAXED);
     }
-
-    memcpy(entry->trades, temp, new_trade_count * sizeof(trade_t));
-    entry->trade_count = new_trade_count;
-
-    if (count > 0) {
-        ma_out->moving_avg = sum_price / count;
-        ma_out->total_volume = total_vol;
-        ma_out->avg_delay = processing_delay_sum / count;  // Average processing delay
-    } else {
-        ma_out->moving_avg = 0;
-        ma_out->total_volume = 0;
-        ma_out->avg_delay = 0;
+    unsigned head = *out_ring.cq_head;
+    unsigned cq_tail = __atomic_load_n(out_ring.cq_tail, __ATOMIC_ACQUIRE);
+    int reaped = 0;
+    while (head != cq_tail) {
+        struct io_uring_cqe *cqe = &out_ring.cqes[head & *out_ring.cq_mask];
+        uint64_t tag = cqe->user_data;
+        if (tag < (uint64_t)count && cqe->res > 0)
+            done[tag] = (size_t)cqe->res;
+        else if (tag >= URING_ENTRIES && tag - URING_ENTRIES < (uint64_t)count)
+            synced[tag - URING_ENTRIES] = (cqe->res == 0);
+        head++;
+        reaped++;
     }
-    ma_out->timestamp = now;
+    __atomic_store_n(out_ring.cq_head, head, __ATOMIC_RELEASE);
+    return reaped;
 }
 
-// --------------------- Per-Minute Worker Thread ---------------------
-// Every minute, log the scheduled vs. actual start time difference, compute moving averages,
-// update MA history for each instrument, and compute Pearson correlations.
-void *per_minute_worker(void *arg) {
-    (void)arg;
-    while (!destroy_flag) {
-        // Determine actual start time and the scheduled minute boundary.
-        struct timespec ts_start;
-        clock_gettime(CLOCK_REALTIME, &ts_start);
-        double actual_start = ts_start.tv_sec + ts_start.tv_nsec / 1e9;
-        double scheduled = floor(actual_start / 60.0) * 60.0;
-        double time_diff = actual_start - scheduled;
+// Write the pending buffers of a batch of files through io_uring, falling back to
+// pwrite for anything the ring did not complete. With `sync`, each write is linked to an
+// IORING_OP_FSYNC of the same file, so writes and group commit take one submission.
+// Every SQE the kernel consumes is reaped before the chunk's iovecs and buffers are
+// reused; SQEs it refuses are withdrawn from the ring and their files written with pwrite.
+static void out_submit_uring(out_file_t **batch, int n, out_sync_t sync) {
+    struct iovec iov[URING_ENTRIES];
+    int per_file = sync ? 2 : 1;
+    int chunk = URING_ENTRIES / per_file;
+    for (int start = 0; start < n; start += chunk) {
+        int count = (n - start < chunk) ? n - start : chunk;
+        unsigned tail = *out_ring.sq_tail;
+        for (int i = 0; i < count; i++) {
+            out_file_t *f = batch[start + i];
+            unsigned idx = tail & *out_ring.sq_mask;
+            struct io_uring_sqe *sqe = &out_ring.sqes[idx];
+            memset(sqe, 0, sizeof(*sqe));
+            iov[i].iov_base = f->pending;
+            iov[i].iov_len = f->pending_len;
+            sqe->opcode = IORING_OP_WRITEV;
+            sqe->fd = f->fd;
+            sqe->addr = (uint64_t)(uintptr_t)&iov[i];
+            sqe->len = 1;
+            sqe->off = (uint64_t)f->pending_offset;
+            sqe->user_data = (uint64_t)i;
+            if (sync)
+                sqe->flags = IOSQE_IO_LINK;
+            out_ring.sq_array[idx] = idx;
+            tail++;
 
-        // Log timing difference.
-        if (timing_file) {
-            char ts_str[20];
-            time_t t_int = ts_start.tv_sec;
-            struct tm *tm_info = localtime(&t_int);
-            strftime(ts_str, sizeof(ts_str), "%Y-%m-%d %H:%M:%S", tm_info);
-            fprintf(timing_file, "%s,%.3f\n", ts_str, time_diff);
-            fflush(timing_file);
+            if (sync) {
+                idx = tail & *out_ring.sq_mask;
+                sqe = &out_ring.sqes[idx];
+                memset(sqe, 0, sizeof(*sqe));
+                sqe->opcode = IORING_OP_FSYNC;
+                sqe->fd = f->fd;
+                sqe->fsync_flags = (sync == OUT_DATASYNC) ? IORING_FSYNC_DATASYNC : 0;
+                sqe->user_data = (uint64_t)(URING_ENTRIES + i);
+                out_ring.sq_array[idx] = idx;
+                tail++;
+            }
         }
-        printf(KBLU "[Timing] Scheduled vs Actual diff: %.3f sec\n" RESET, time_diff);
-
-
-        // Calculate sleep duration until the next minute.
-        double next_minute = ceil(actual_start / 60.0) * 60.0;
-        double sleep_duration = next_minute - actual_start;
-
-        // Sleep with nanosecond precision.
-        struct timespec sleep_time;
-        sleep_time.tv_sec = (time_t)sleep_duration;
-        sleep_time.tv_nsec = (long)((sleep_duration - sleep_time.tv_sec) * 1e9);
-        nanosleep(&sleep_time, NULL);
+        __atomic_store_n(out_ring.sq_tail, tail, __ATOMIC_RELEASE);
 
-
-        // Compute moving averages.
-        clock_gettime(CLOCK_REALTIME, &ts_start);
-        double now = ts_start.tv_sec + ts_start.tv_nsec / 1e9;
-        char timestamp[20];
-        time_t now_int = ts_start.tv_sec;
-        struct tm *tm_info = localtime(&now_int);
-        strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
-
-        pthread_mutex_lock(&ma_mutex);
-        for (int i = 0; i < num_instruments; i++) {
-            ma_entry_t new_ma;
-            compute_moving_avg_and_volume(&instruments[i], now, &new_ma);
-            if (instruments[i].ma_count < MA_HISTORY_SIZE) {
-                instruments[i].ma_history[instruments[i].ma_count] = new_ma;
-                instruments[i].ma_count++;
-            } else {
-                for (int k = 1; k < MA_HISTORY_SIZE; k++) {
-                    instruments[i].ma_history[k - 1] = instruments[i].ma_history[k];
-                }
-                instruments[i].ma_history[MA_HISTORY_SIZE - 1] = new_ma;
+        // Submit until the kernel has consumed every SQE. EINTR, EAGAIN and EBUSY are
+        // retried, reaping (or waiting for) completions first to make room in the CQ ring.
+        int expected = count * per_file;
+        int submitted = 0, reaped = 0, failures = 0;
+        size_t done[URING_ENTRIES] = {0};
+        int synced[URING_ENTRIES] = {0};
+        while (submitted < expected) {
+            int ret = (int)syscall(__NR_io_uring_enter, out_ring.fd, expected - submitted, 0, 0, NULL, 0);
+            __atomic_fetch_add(&out_stats.syscalls, 1, __ATOMIC_RELAXED);
+            if (ret > 0) {
+                submitted += ret;
+                failures = 0;
+                continue;
             }
-            if (instruments[i].ma_file) {
-                fprintf(instruments[i].ma_file, "%s,%.2f,%.4f,%.9f\n",
-                        timestamp, new_ma.moving_avg, new_ma.total_volume, new_ma.avg_delay);
-                fflush(instruments[i].ma_file);
+            int retry = ret < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY);
+            if (!retry || ++failures > URING_ENTRIES) {
+                // Withdraw the SQEs the kernel never consumed; their files go through pwrite.
+                __atomic_store_n(out_ring.sq_tail, *out_ring.sq_head, __ATOMIC_RELEASE);
+                break;
             }
+            if (errno != EINTR)
+                reaped += uring_reap(count, done, synced, reaped < submitted);
         }
-        // Build correlation data array for instruments with complete MA history.
-        int valid_count = 0;
-        corr_data_t *corr_array = malloc(num_instruments * sizeof(corr_data_t));
-        for (int i = 0; i < num_instruments; i++) {
-            if (instruments[i].ma_count >= MA_HISTORY_SIZE) {
-                corr_array[valid_count].global_index = i;
-                strncpy(corr_array[valid_count].instrument, instruments[i].instrument,
-                        sizeof(corr_array[valid_count].instrument) - 1);
-                corr_array[valid_count].instrument[sizeof(corr_array[valid_count].instrument) - 1] = '\0';
+        while (reaped < submitted)
+            reaped += uring_reap(count, done, synced, 1);
 
-                // Copy the MA history (including timestamps)
-                memcpy(corr_array[valid_count].ma, instruments[i].ma_history, MA_HISTORY_SIZE * sizeof(ma_entry_t));
-                valid_count++;
+        // Short or failed writes are completed synchronously; their linked fsync was
+        // cancelled, so the file stays marked unsynced for out_flush_all.
+        for (int i = 0; i < count; i++) {
+            out_file_t *f = batch[start + i];
+            __atomic_fetch_add(&out_stats.bytes, done[i], __ATOMIC_RELAXED);
+            __atomic_store_n(&f->unsynced, 1, __ATOMIC_RELAXED);
+            if (done[i] < f->pending_len) {
+                out_pwrite_all(f, f->pending + done[i], f->pending_len - done[i],
+                               f->pending_offset + (off_t)done[i]);
+            } else if (synced[i]) {
+                __atomic_store_n(&f->unsynced, 0, __ATOMIC_RELAXED);
+                __atomic_fetch_add(&out_stats.syncs, 1, __ATOMIC_RELAXED);
             }
         }
-        pthread_mutex_unlock(&ma_mutex);
+    }
+}
 
-        // If there is more than one instrument with complete MA history, compute correlations.
-        if (valid_count > 1) {
-            pthread_t threads[valid_count];
-            for (int i = 0; i < valid_count; i++) {
-                corr_thread_arg_t *ct_arg = malloc(sizeof(corr_thread_arg_t));
-                ct_arg->index = i;
-                ct_arg->total = valid_count;
-                ct_arg->data = corr_array;
-                ct_arg->current_time = now;
-                pthread_create(&threads[i], NULL, compute_corr_thread, ct_arg);
+// Flush every dirty file once, then sync every file holding unsynced data if requested.
+static void out_flush_all(out_sync_t sync) {
+    pthread_mutex_lock(&out_files_lock);
+    int n = 0, cap = 0;
+    out_file_t **batch = NULL;
+    for (out_file_t *f = out_files; f; f = f->next) {
+        pthread_mutex_lock(&f->lock);
+        if (f->active_len > 0) {
+            char *tmp = f->pending;
+            f->pending = f->active;
+            f->pending_len = f->active_len;
+            f->pending_offset = f->offset;
+            f->offset += (off_t)f->active_len;
+            f->active = tmp;
+            f->active_len = 0;
+            if (n == cap) {
+                cap = cap ? cap * 2 : 64;
+                batch = realloc(batch, cap * sizeof(*batch));
             }
-            for (int i = 0; i < valid_count; i++) {
-                pthread_join(threads[i], NULL);
+            batch[n++] = f;
+        }
+        pthread_mutex_unlock(&f->lock);
+    }
+
+    if (n > 0) {
+        for (int i = 0; i < n; i++)
+            out_preallocate(batch[i], batch[i]->pending_offset, batch[i]->pending_len);
+        if (options.output == OUTPUT_IO_URING && out_ring.fd >= 0) {
+            out_submit_uring(batch, n, sync);
+        } else {
+            for (int i = 0; i < n; i++) {
+                out_file_t *f = batch[i];
+                struct iovec iov = { f->pending, f->pending_len };
+                ssize_t w = pwritev(f->fd, &iov, 1, f->pending_offset);
+                __atomic_fetch_add(&out_stats.syscalls, 1, __ATOMIC_RELAXED);
+                size_t written = (w > 0) ? (size_t)w : 0;
+                __atomic_fetch_add(&out_stats.bytes, written, __ATOMIC_RELAXED);
+                __atomic_store_n(&f->unsynced, 1, __ATOMIC_RELAXED);
+                if (written < f->pending_len)
+                    out_pwrite_all(f, f->pending + written, f->pending_len - written,
+                                   f->pending_offset + (off_t)written);
             }
         }
-        free(corr_array);
+        for (int i = 0; i < n; i++)
+            batch[i]->pending_len = 0;
+        __atomic_fetch_add(&out_stats.flushes, 1, __ATOMIC_RELAXED);
     }
-    return NULL;
+
+    // Files written outside the batch (sync backend, overflowing buffers) or whose
+    // linked fsync did not run are synced here.
+    if (sync) {
+        for (out_file_t *f = out_files; f; f = f->next) {
+            if (!__atomic_exchange_n(&f->unsynced, 0, __ATOMIC_RELAXED))
+                continue;
+            int rc = (sync == OUT_DATASYNC) ? fdatasync(f->fd) : fsync(f->fd);
+            __atomic_fetch_add(&out_stats.syscalls, 1, __ATOMIC_RELAXED);
+            if (rc == 0)
+                __atomic_fetch_add(&out_stats.syncs, 1, __ATOMIC_RELAXED);
+            else
+                fprintf(stderr, "[ERROR] Sync of %s failed: %s\n", f->path, strerror(errno));
+        }
+    }
+    pthread_mutex_unlock(&out_files_lock);
+    free(batch);
 }
 
-// --------------------- CPU Idle Monitor Thread ---------------------
-// Reads /proc/stat every second, computes the CPU idle percentage, and logs it.
-void *cpu_idle_monitor(void *arg) {
-    (void)arg;
-    FILE *fp;
-    char buffer[256];
-    unsigned long prev_idle = 0, prev_total = 0;
+// Sync point at the end of a minute pass (--durability minute).
+void out_minute_commit(void) {
+    if (options.durability == DURABILITY_MINUTE)
+        out_flush_all(OUT_DATASYNC);
+}
 
-    cpu_idle_file = fopen("cpu_idle.csv", "w");
-    if (cpu_idle_file) {
-        fprintf(cpu_idle_file, "Timestamp,IdlePercent\n");
-        fflush(cpu_idle_file);
+// --------------------- Output Rotation ---------------------
+
+// Period key of time t: YYYYMMDD for daily rotation, YYYYMMDDHH for hourly.
+static void rotation_period(time_t t, char *buf, size_t size) {
+    struct tm tm_info;
+    localtime_r(&t, &tm_info);
+    strftime(buf, size, options.rotate == ROTATE_HOURLY ? "%Y%m%d%H" : "%Y%m%d", &tm_info);
+}
+
+// Segment name for path and period: data/BTC-USDT/transactions.csv -> transactions-20240101.csv.
+// The period goes before the first dot of the name, so transactions.csv.idx becomes
+// transactions-20240101.csv.idx and stays next to its data segment.
+static void segment_path(const char *path, const char *period, char *buf, size_t size) {
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    const char *dot = strchr(base, '.');
+    if (!dot)
+        dot = path + strlen(path);
+    snprintf(buf, size, "%.*s-%s%s", (int)(dot - path), path, period, dot);
+    // A restart within the same period must not overwrite an earlier segment.
+    char probe[320];
+    snprintf(probe, sizeof(probe), "%s.gz", buf);
+    for (int n = 1; access(buf, F_OK) == 0 || access(probe, F_OK) == 0; n++) {
+        snprintf(buf, size, "%.*s-%s-%d%s", (int)(dot - path), path, period, n, dot);
+        snprintf(probe, sizeof(probe), "%s.gz", buf);
     }
+}
 
-    while (!destroy_flag) {
-        fp = fopen("/proc/stat", "r");
-        if (fp) {
-            if (fgets(buffer, sizeof(buffer), fp)) {
-                unsigned long user, nice, system, idle, iowait, irq, softirq, steal;
-                sscanf(buffer, "cpu  %lu %lu %lu %lu %lu %lu %lu %lu",
-                       &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal);
-                unsigned long total = user + nice + system + idle + iowait + irq + softirq + steal;
-                if (prev_total != 0) {
-                    unsigned long d_total = total - prev_total;
-                    unsigned long d_idle = idle - prev_idle;
-                    double idle_percent = (d_total > 0) ? (100.0 * d_idle / d_total) : 0.0;
-
-                    time_t now = time(NULL);
-                    char ts[20];
-                    struct tm *tm_info = localtime(&now);
-                    strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", tm_info);
-                    if (cpu_idle_file) {
-                        fprintf(cpu_idle_file, "%s,%.3f\n", ts, idle_percent);
-                        fflush(cpu_idle_file);
-                    }
-                }
-                prev_total = total;
-                prev_idle = idle;
-            }
-            fclose(fp);
-        }
-        sleep(1);
+static void compress_enqueue(const char *path, int fd, off_t length, int trim) {
+    compress_job_t *job = malloc(sizeof(*job));
+    if (!job) {
+        if (fd >= 0)
+            close(fd);
+        return;
     }
-    if (cpu_idle_file)
-        fclose(cpu_idle_file);
-    return NULL;
+    snprintf(job->path, sizeof(job->path), "%s", path);
+    job->fd = fd;
+    job->length = length;
+    job->trim = trim;
+    pthread_mutex_lock(&compress_lock);
+    compress_job_t **tail = &compress_queue;
+    while (*tail)
+        tail = &(*tail)->next;
+    job->next = NULL;
+    *tail = job;
+    pthread_cond_signal(&compress_cond);
+    pthread_mutex_unlock(&compress_lock);
 }
 
-// --------------------- WebSocket Write Helper ---------------------
+// gzip path to path.gz and remove path on success.
+static void compress_segment(const char *path) {
+    char gz_path[320];
+    snprintf(gz_path, sizeof(gz_path), "%s.gz", path);
+    int in = open(path, O_RDONLY | O_CLOEXEC);
+    if (in < 0)
+        return;
+    gzFile out = gzopen(gz_path, "wb6");
+    if (!out) {
+        close(in);
+        return;
+    }
+    char *buf = malloc(COMPRESS_CHUNK);
+    ssize_t n = -1;
+    int ok = buf != NULL;
+    while (ok && (n = read(in, buf, COMPRESS_CHUNK)) > 0)
+        ok = gzwrite(out, buf, (unsigned)n) == (int)n;
+    free(buf);
+    close(in);
+    if (gzclose(out) == Z_OK && ok && n == 0) {
+        unlink(path);
+    } else {
+        fprintf(stderr, "[ERROR] Could not compress %s\n", path);
+        unlink(gz_path);
+    }
+}
+
+// Background compressor: idle CPU and I/O priority so it never competes with ingestion.
+static void *compress_worker(void *arg) {
+    (void)arg;
+    struct sched_param param = { 0 };
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+    syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, 0, 3 << 13 /* IOPRIO_CLASS_IDLE */);
+
+    for (;;) {
+        pthread_mutex_lock(&compress_lock);
+        while (!compress_queue && !compress_stop)
+            pthread_cond_wait(&compress_cond, &compress_lock);
+        compress_job_t *job = compress_queue;
+        if (job)
+            compress_queue = job->next;
+        pthread_mutex_unlock(&compress_lock);
+        if (!job)
+            break;
+        if (job->fd >= 0) {
+            if (job->trim && ftruncate(job->fd, job->length) != 0)
+                fprintf(stderr, "[ERROR] Could not trim %s\n", job->path);
+            if (options.durability != DURABILITY_NONE)
+                fsync(job->fd);
+            close(job->fd);
+        }
+        compress_segment(job->path);
+        free(job);
+    }
+    return NULL;
+}
+
+// Close the current segment of f and continue in a fresh file with the same header. Only
+// the rename and the open happen here; the compress thread trims and syncs the segment.
+static void out_rotate_file(out_file_t *f, const char *period) {
+    f->rotation = out_rotation;
+    if (f->no_rotate)
+        return;
+    pthread_mutex_lock(&f->lock);
+    if (f->active_len > 0) {
+        out_pwrite_all(f, f->active, f->active_len, f->offset);
+        f->offset += (off_t)f->active_len;
+        f->active_len = 0;
+    }
+    if (f->offset <= (off_t)f->header_len) {
+        // Nothing but the header was written in this period.
+        pthread_mutex_unlock(&f->lock);
+        return;
+    }
+
+    char segment[300];
+    segment_path(f->path, period, segment, sizeof(segment));
+    int fd = -1;
+    if (rename(f->path, segment) == 0)
+        fd = open(f->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "[ERROR] Could not rotate %s: %s\n", f->path, strerror(errno));
+        pthread_mutex_unlock(&f->lock);
+        return;
+    }
+    compress_enqueue(segment, f->fd, f->offset, f->allocated > f->offset);
+    f->fd = fd;
+    f->offset = 0;
+    f->allocated = 0;
+    __atomic_store_n(&f->unsynced, 0, __ATOMIC_RELAXED);
+    if (f->header) {
+        memcpy(f->active, f->header, f->header_len);
+        f->active_len = f->header_len;
+    }
+    pthread_mutex_unlock(&f->lock);
+}
+
+// Rotate every output file once the rotation period has changed.
+static void out_rotate_if_due(void) {
+    if (options.rotate == ROTATE_NONE)
+        return;
+    char period[16];
+    rotation_period(time(NULL), period, sizeof(period));
+    if (strcmp(period, out_period) == 0)
+        return;
+
+    char closed[16];
+    memcpy(closed, out_period, sizeof(closed));
+    memcpy(out_period, period, sizeof(out_period));
+    out_rotation++;
+    // Write out what is staged first, so that switching a file moves few bytes.
+    out_flush_all(OUT_NO_SYNC);
+    // Rows and their index entries are written under ma_mutex, so holding it while the
+    // files of an instrument are switched keeps each data file and its .idx in the same
+    // segment. It is taken once per instrument to let ingestion run in between. The files
+    // of an active instrument are only closed after it is retired, under ma_mutex.
+    for (int i = 0; i < __atomic_load_n(&num_instruments, __ATOMIC_ACQUIRE); i++) {
+        pthread_mutex_lock(&ma_mutex);
+        moving_avg_t *inst = &instruments[i];
+        if (INSTRUMENT_ACTIVE(i)) {
+            out_file_t *files[] = { inst->trans_file, inst->trans_idx, inst->ma_file, inst->ma_idx,
+                                    inst->corr_file, inst->journal_file, inst->journal_idx };
+            for (size_t k = 0; k < sizeof(files) / sizeof(files[0]); k++) {
+                if (files[k])
+                    out_rotate_file(files[k], closed);
+            }
+        }
+        inst->trans_rows = 0;
+        inst->ma_rows = 0;
+        pthread_mutex_unlock(&ma_mutex);
+    }
+    // The global logs, and the files of instruments being added or removed.
+    pthread_mutex_lock(&ma_mutex);
+    pthread_mutex_lock(&out_files_lock);
+    for (out_file_t *f = out_files; f; f = f->next) {
+        if (f->rotation != out_rotation)
+            out_rotate_file(f, closed);
+    }
+    pthread_mutex_unlock(&out_files_lock);
+    pthread_mutex_unlock(&ma_mutex);
+    printf(KYEL "[Output] Rotated output files of period %s\n" RESET, closed);
+}
+
+// Writer thread: flush all files every --commit-ms until stopped, applying the
+// periodic and group-commit durability policies.
+static void *output_writer_thread(void *arg) {
+    (void)arg;
+    struct timespec interval = { options.commit_ms / 1000, (options.commit_ms % 1000) * 1000000L };
+    long since_sync_ms = 0;
+    while (!out_thread_stop) {
+        nanosleep(&interval, NULL);
+        out_sync_t sync = OUT_NO_SYNC;
+        if (options.durability == DURABILITY_GROUP) {
+            sync = OUT_DATASYNC;
+        } else if (options.durability == DURABILITY_PERIODIC) {
+            since_sync_ms += options.commit_ms;
+            if (since_sync_ms >= DURABILITY_PERIOD_MS) {
+                sync = OUT_FSYNC;
+                since_sync_ms = 0;
+            }
+        }
+        // With the sync backend rows are already written; only the sync is left to do.
+        if (options.output != OUTPUT_SYNC || sync != OUT_NO_SYNC)
+            out_flush_all(sync);
+        out_rotate_if_due();
+    }
+    return NULL;
+}
+
+// Start the writer thread for the batched backends (io_uring falls back to writev).
+void out_start(void) {
+    if (options.output == OUTPUT_IO_URING && uring_init(&out_ring, URING_ENTRIES) != 0) {
+        printf(KRED "[Output] io_uring unavailable (%s), falling back to writev\n" RESET, strerror(errno));
+        options.output = OUTPUT_WRITEV;
+    }
+    int needs_thread = options.output != OUTPUT_SYNC || options.rotate != ROTATE_NONE ||
+                       options.durability == DURABILITY_PERIODIC || options.durability == DURABILITY_GROUP;
+    if (needs_thread && !out_thread_running) {
+        out_thread_stop = 0;
+        if (pthread_create(&out_thread, NULL, output_writer_thread, NULL) == 0)
+            out_thread_running = 1;
+    }
+    if (options.rotate != ROTATE_NONE && !compress_thread_running) {
+        rotation_period(time(NULL), out_period, sizeof(out_period));
+        compress_stop = 0;
+        if (pthread_create(&compress_thread, NULL, compress_worker, NULL) == 0)
+            compress_thread_running = 1;
+    }
+    printf(KGRN "[Output] Backend: %s, durability: %s, rotation: %s\n" RESET,
+           output_backend_names[options.output], durability_names[options.durability],
+           rotate_names[options.rotate]);
+}
+
+// Stop the writer thread after a final flush; queued segments are still compressed.
+void out_stop(void) {
+    if (out_thread_running) {
+        out_thread_stop = 1;
+        pthread_join(out_thread, NULL);
+        out_thread_running = 0;
+    }
+    if (compress_thread_running) {
+        pthread_mutex_lock(&compress_lock);
+        compress_stop = 1;
+        pthread_cond_signal(&compress_cond);
+        pthread_mutex_unlock(&compress_lock);
+        pthread_join(compress_thread, NULL);
+        compress_thread_running = 0;
+    }
+    out_flush_all(options.durability == DURABILITY_NONE ? OUT_NO_SYNC : OUT_FSYNC);
+    uring_destroy(&out_ring);
+}
+
+// Append raw bytes to an output file.
+void out_write(out_file_t *f, const char *data, size_t len) {
+    if (!f)
+        return;
+    pthread_mutex_lock(&f->lock);
+    if (options.output == OUTPUT_SYNC || f->active_len + len > f->buf_size) {
+        // Write out what is staged plus this row right away, at reserved offsets.
+        off_t offset = f->offset;
+        f->offset += (off_t)(f->active_len + len);
+        if (f->active_len > 0)
+            out_pwrite_all(f, f->active, f->active_len, offset);
+        out_pwrite_all(f, data, len, offset + (off_t)f->active_len);
+        f->active_len = 0;
+    } else {
+        memcpy(f->active + f->active_len, data, len);
+        f->active_len += len;
+    }
+    pthread_mutex_unlock(&f->lock);
+}
+
+// Append a formatted row to an output file.
+void out_printf(out_file_t *f, const char *fmt, ...) {
+    if (!f)
+        return;
+    char row[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(row, sizeof(row), fmt, ap);
+    va_end(ap);
+    if (len < 0)
+        return;
+    if ((size_t)len < sizeof(row)) {
+        out_write(f, row, (size_t)len);
+        return;
+    }
+    char *big = malloc((size_t)len + 1);
+    if (!big)
+        return;
+    va_start(ap, fmt);
+    vsnprintf(big, (size_t)len + 1, fmt, ap);
+    va_end(ap);
+    out_write(f, big, (size_t)len);
+    free(big);
+}
+
+// Logical size of an output file, i.e. the offset at which the next row will land.
+off_t out_tell(out_file_t *f) {
+    if (!f)
+        return 0;
+    pthread_mutex_lock(&f->lock);
+    off_t pos = f->offset + (off_t)f->active_len;
+    pthread_mutex_unlock(&f->lock);
+    return pos;
+}
+
+// Append an entry (row time, row offset) to a sparse time index.
+void out_index(out_file_t *idx, double ts, off_t offset) {
+    if (!idx)
+        return;
+    journal_index_entry_t entry = { llround(ts * 1e9), (uint64_t)offset };
+    out_write(idx, (const char *)&entry, sizeof(entry));
+}
+
+// Open an output file (truncated, or appended to if `append`) with a staging buffer of
+// buf_size bytes and write `header`, which is written again at the top of every rotated
+// file. The header may be binary. With no_rotate set the file is never rotated.
+static out_file_t *out_open_buffered(const char *path, const void *header, size_t header_len, int append,
+                                     size_t buf_size, int no_rotate) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC | (append ? 0 : O_TRUNC), 0644);
+    if (fd < 0)
+        return NULL;
+    out_file_t *f = calloc(1, sizeof(*f));
+    if (!f) {
+        close(fd);
+        return NULL;
+    }
+    f->fd = fd;
+    snprintf(f->path, sizeof(f->path), "%s", path);
+    pthread_mutex_init(&f->lock, NULL);
+    f->buf_size = buf_size;
+    f->no_rotate = no_rotate;
+    f->active = malloc(buf_size);
+    f->pending = malloc(buf_size);
+    f->offset = append ? lseek(fd, 0, SEEK_END) : 0;
+    f->allocated = f->offset;
+    if (header && header_len > 0 && header_len <= buf_size) {
+        f->header = malloc(header_len);
+        memcpy(f->header, header, header_len);
+        f->header_len = header_len;
+        if (f->offset == 0)  // Appending to an existing file: it has its header
+            out_write(f, f->header, f->header_len);
+    }
+
+    pthread_mutex_lock(&out_files_lock);
+    f->next = out_files;
+    out_files = f;
+    pthread_mutex_unlock(&out_files_lock);
+    return f;
+}
+
+out_file_t *out_open_bin(const char *path, const void *header, size_t header_len, int append) {
+    return out_open_buffered(path, header, header_len, append, OUT_BUFFER_SIZE, 0);
+}
+
+// Open an output file with a CSV header line (or none).
+out_file_t *out_open(const char *path, const char *header, int append) {
+    return out_open_bin(path, header, header ? strlen(header) : 0, append);
+}
+
+// Same, with a staging buffer of buf_size bytes (per-instrument files of a large universe).
+out_file_t *out_open_sized(const char *path, const char *header, int append, size_t buf_size) {
+    return out_open_buffered(path, header, header ? strlen(header) : 0, append, buf_size, 0);
+}
+
+// Open a headerless file that rotation leaves whole (the --record feed, which --replay
+// reads back as one file).
+out_file_t *out_open_unrotated(const char *path, int append) {
+    return out_open_buffered(path, NULL, 0, append, OUT_BUFFER_SIZE, 1);
+}
+
+// Flush and close an output file, releasing preallocated space past the data.
+void out_close(out_file_t *f) {
+    if (!f)
+        return;
+    pthread_mutex_lock(&out_files_lock);
+    for (out_file_t **pp = &out_files; *pp; pp = &(*pp)->next) {
+        if (*pp == f) {
+            *pp = f->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&out_files_lock);
+
+    if (f->active_len > 0)
+        out_pwrite_all(f, f->active, f->active_len, f->offset);
+    f->offset += (off_t)f->active_len;
+    if (f->allocated > f->offset && ftruncate(f->fd, f->offset) != 0)
+        fprintf(stderr, "[ERROR] Could not trim %s\n", f->path);
+    if (options.durability != DURABILITY_NONE)
+        fsync(f->fd);
+    close(f->fd);
+    pthread_mutex_destroy(&f->lock);
+    free(f->active);
+    free(f->pending);
+    free(f->header);
+    free(f);
+}
+
+// --------------------- Decimal Parsing ---------------------
+// OKX sends prices and sizes as decimal strings ("43251.7", "0.00012"). These helpers
+// convert them without going through the locale-aware atof/strtod.
+
+static const int64_t pow10_i64[MAX_DECIMALS + 1] = {
+    1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL, 10000000LL, 100000000LL,
+    1000000000LL, 10000000000LL, 100000000000LL, 1000000000000LL, 10000000000000LL,
+    100000000000000LL, 1000000000000000LL, 10000000000000000LL, 100000000000000000LL,
+    1000000000000000000LL
+};
+
+// Powers of ten that are exactly representable as doubles.
+static const double pow10_f64[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Parse a decimal string into an integer scaled by 10^decimals. Fractional digits beyond
+// the scale are rounded half-up. Returns 0 on success, -1 on malformed input or overflow.
+int parse_decimal_fx(const char *s, int decimals, int64_t *out) {
+    int neg = 0;
+    if (*s == '-' || *s == '+')
+        neg = (*s++ == '-');
+    if (decimals < 0 || decimals > MAX_DECIMALS)
+        return -1;
+
+    uint64_t value = 0;
+    int digits = 0;
+    for (; *s >= '0' && *s <= '9'; s++, digits++) {
+        if (value > (UINT64_MAX - 9) / 10)
+            return -1;
+        value = value * 10 + (uint64_t)(*s - '0');
+    }
+    int frac = 0;
+    int round_up = 0;
+    if (*s == '.') {
+        s++;
+        for (; *s >= '0' && *s <= '9'; s++, digits++) {
+            if (frac < decimals) {
+                if (value > (UINT64_MAX - 9) / 10)
+                    return -1;
+                value = value * 10 + (uint64_t)(*s - '0');
+                frac++;
+            } else if (frac == decimals) {
+                round_up = (*s >= '5');
+                frac++;  // Remaining digits only affect rounding of the first dropped one.
+            }
+        }
+    }
+    if (digits == 0 || *s != '\0')
+        return -1;
+    if (frac > decimals)
+        frac = decimals;
+
+    // Scale up to the requested number of decimals.
+    uint64_t mul = (uint64_t)pow10_i64[decimals - frac];
+    if (value > (uint64_t)INT64_MAX / mul)
+        return -1;
+    value = value * mul + (uint64_t)round_up;
+    if (value > (uint64_t)INT64_MAX)
+        return -1;
+    *out = neg ? -(int64_t)value : (int64_t)value;
+    return 0;
+}
+
+// Parse a decimal string into a double. Strings with at most 15 significant digits and
+// 22 fractional digits take an exact path (one correctly rounded division of two exact
+// values); everything else falls back to strtod.
+double parse_decimal_double(const char *s) {
+    const char *start = s;
+    int neg = 0;
+    if (*s == '-' || *s == '+')
+        neg = (*s++ == '-');
+
+    uint64_t mantissa = 0;
+    int digits = 0, frac = 0;
+    for (; *s >= '0' && *s <= '9'; s++) {
+        mantissa = mantissa * 10 + (uint64_t)(*s - '0');
+        if (mantissa != 0)
+            digits++;
+        if (digits > 15)
+            return strtod(start, NULL);
+    }
+    if (*s == '.') {
+        s++;
+        for (; *s >= '0' && *s <= '9'; s++, frac++) {
+            mantissa = mantissa * 10 + (uint64_t)(*s - '0');
+            if (mantissa != 0)
+                digits++;
+            if (digits > 15 || frac >= 22)
+                return strtod(start, NULL);
+        }
+    }
+    if (*s != '\0')
+        return strtod(start, NULL);
+    double v = (double)mantissa / pow10_f64[frac];
+    return neg ? -v : v;
+}
+
+// Format a fixed-point value with exactly `decimals` fractional digits.
+int format_decimal_fx(char *buf, size_t size, int64_t value, int decimals) {
+    if (decimals <= 0)
+        return snprintf(buf, size, "%lld", (long long)value);
+    uint64_t mag = (value < 0) ? (uint64_t)0 - (uint64_t)value : (uint64_t)value;
+    uint64_t scale = (uint64_t)pow10_i64[decimals];
+    return snprintf(buf, size, "%s%llu.%0*llu", (value < 0) ? "-" : "",
+                    (unsigned long long)(mag / scale), decimals,
+                    (unsigned long long)(mag % scale));
+}
+
+// Convert a fixed-point sum to a real value.
+static inline double fx_to_double(fx_sum_t value, int decimals) {
+    return (double)value / (double)pow10_i64[decimals];
+}
+
+// Tick (price) and lot (size) decimals of the subscribed OKX spot instruments.
+typedef struct {
+    const char *instrument;
+    int price_decimals;
+    int size_decimals;
+} instrument_spec_t;
+
+#ifdef OKX_FIXED_UNIVERSE
+#define INSTRUMENT_SPEC(id, name, pd, sd) {name, pd, sd},
+static const instrument_spec_t instrument_specs[] = { OKX_SYMBOLS(INSTRUMENT_SPEC) };
+#undef INSTRUMENT_SPEC
+#else
+static const instrument_spec_t instrument_specs[] = {
+    {"BTC-USDT",  1, 8},
+    {"ADA-USDT",  4, 6},
+    {"ETH-USDT",  2, 6},
+    {"DOGE-USDT", 5, 6},
+    {"XRP-USDT",  4, 6},
+    {"SOL-USDT",  2, 6},
+    {"LTC-USDT",  2, 6},
+    {"BNB-USDT",  1, 6},
+};
+#endif
+
+// Look up the fixed-point scales for an instrument, falling back to the defaults.
+void lookup_instrument_spec(const char *instrument, int *price_decimals, int *size_decimals) {
+    *price_decimals = PRICE_DECIMALS_DEFAULT;
+    *size_decimals = SIZE_DECIMALS_DEFAULT;
+    for (size_t i = 0; i < sizeof(instrument_specs) / sizeof(instrument_specs[0]); i++) {
+        if (strcmp(instrument_specs[i].instrument, instrument) == 0) {
+            *price_decimals = instrument_specs[i].price_decimals;
+            *size_decimals = instrument_specs[i].size_decimals;
+            return;
+        }
+    }
+}
+
+#ifdef OKX_FIXED_UNIVERSE
+// Map an instId to its id with the generated perfect hash (no table probing).
+static inline inst_id_t intern_lookup(const char *s, size_t len) {
+    return okx_fixed_lookup(s, len);
+}
+#else
+// FNV-1a hash of an instId.
+static inline uint32_t intern_hash(const char *s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Map an instId (not necessarily NUL-terminated) to its dense id, or INST_ID_NONE.
+static inline inst_id_t intern_lookup(const char *s, size_t len) {
+    uint32_t slot = intern_hash(s, len) & (INTERN_TABLE_SIZE - 1);
+    while (intern_table[slot]) {
+        inst_id_t id = intern_table[slot] - 1;
+        if (instruments[id].instrument_len == len && memcmp(instruments[id].instrument, s, len) == 0)
+            return id;
+        slot = (slot + 1) & (INTERN_TABLE_SIZE - 1);
+    }
+    return INST_ID_NONE;
+}
+#endif
+
+// Initialize the entry for a newly interned instrument and open its log files, truncated
+// or appended to. `expected` is the number of trades it is expected to store per window
+// (0: unknown); the window, staging buffers and preallocation steps are sized from it
+// instead of for the busiest case. Returns -1 if the trade window cannot be allocated.
+static int init_instrument(inst_id_t id, const char *instrument, size_t len, int expected, int append) {
+    moving_avg_t *inst = &instruments[id];
+    inst_hot_t *hot = &inst_hot[id];
+    memcpy(inst->instrument, instrument, len + 1);
+    inst->instrument_len = len;
+    snprintf(inst->channel, sizeof(inst->channel), "tickers");
+    inst->max_corr_time = 0;
+    memset(hot, 0, sizeof(*hot));
+    lookup_instrument_spec(inst->instrument, &hot->price_decimals, &hot->size_decimals);
+    hot->max_corr = -2.0;
+    hot->max_corr_id = INST_ID_NONE;
+    hot->dedup = channel_dedup(inst->channel);
+
+    // Twice the expected trades, as a power of two; flat windows grow when that is exceeded.
+    size_t buf_size = OUT_BUFFER_SIZE;
+    hot->capacity = trade_head_capacity;
+    if (expected > 0) {
+        int capacity = TRADE_MIN_CAPACITY;
+        while (capacity < 2 * expected && capacity < trade_head_capacity)
+            capacity *= 2;
+        hot->capacity = capacity < trade_head_capacity ? capacity : trade_head_capacity;
+        buf_size = OUT_BUFFER_MIN;
+        while (buf_size < OUT_BUFFER_SIZE && buf_size * TICKER_MAX_PER_WINDOW < (size_t)expected * OUT_BUFFER_SIZE)
+            buf_size *= 2;
+    }
+
+#ifdef OKX_FIXED_UNIVERSE
+    inst_trades[id] = fixed_trade_storage[id];
+    hot->capacity = trade_head_capacity;
+    if (options.hugepages != HUGEPAGES_OFF)
+        advise_huge(inst_trades[id], TRADE_BUFFER_SIZE * sizeof(trade_t));
+#else
+    inst_trades[id] = window_alloc(hot->capacity);
+    if (!inst_trades[id]) {
+        fprintf(stderr, "Could not allocate trade window for %s\n", instrument);
+        return -1;
+    }
+#endif
+
+    char dirpath[128];
+    create_instrument_dir(instrument, dirpath, sizeof(dirpath));
+    char filename[256];
+
+    // Open transactions file.
+    snprintf(filename, sizeof(filename), "%s/transactions.csv", dirpath);
+    inst->trans_file = out_open_sized(filename, dedup_marking() ? "Timestamp,Price,Volume,ProcessingDelay,Repeat\n"
+                                                                : "Timestamp,Price,Volume,ProcessingDelay\n",
+                                      append, buf_size);
+    if (inst->trans_file) {
+        printf("[DEBUG] Opened transactions file: %s\n", filename);
+    } else {
+        printf("[ERROR] Could not open transactions file: %s\n", filename);
+    }
+
+    // Open moving average file.
+    snprintf(filename, sizeof(filename), "%s/moving_average.csv", dirpath);
+    inst->ma_file = out_open_sized(filename, "Timestamp,MovingAvg,TotalVolume,AvgProcessingDelay,Stale\n", append, buf_size);
+    if (inst->ma_file) {
+        printf("[DEBUG] Opened moving average file: %s\n", filename);
+    } else {
+        printf("[ERROR] Could not open moving average file: %s\n", filename);
+    }
+
+    // Open correlation file.
+    snprintf(filename, sizeof(filename), "%s/correlation.csv", dirpath);
+    inst->corr_file = out_open_sized(filename, "Timestamp,OtherSymbol,Correlation,MaxCorrMATime,StaleMask,SkippedPairs\n",
+                                     append, buf_size);
+    if (inst->corr_file) {
+        printf("[DEBUG] Opened correlation file: %s\n", filename);
+    } else {
+        printf("[ERROR] Could not open correlation file: %s\n", filename);
+    }
+
+    // Open the compressed trade journal.
+    if (options.window == WINDOW_COMPRESSED) {
+        snprintf(filename, sizeof(filename), "%s/trades.journal", dirpath);
+        inst->journal_file = out_open_sized(filename, NULL, append, buf_size);
+        if (!inst->journal_file)
+            printf("[ERROR] Could not open trade journal: %s\n", filename);
+        snprintf(filename, sizeof(filename), "%s/trades.journal.idx", dirpath);
+        inst->journal_idx = out_open_sized(filename, NULL, append, buf_size);
+    }
+
+    // Sparse time indexes used by okx_query.
+    snprintf(filename, sizeof(filename), "%s/transactions.csv.idx", dirpath);
+    inst->trans_idx = out_open_sized(filename, NULL, append, buf_size);
+    snprintf(filename, sizeof(filename), "%s/moving_average.csv.idx", dirpath);
+    inst->ma_idx = out_open_sized(filename, NULL, append, buf_size);
+    inst->trans_rows = 0;
+    inst->ma_rows = 0;
+    return 0;
+}
+
+// Intern an instrument: assign its dense id, initialize its entry and open its log files.
+// `expected` is its expected trades per window, 0 if unknown (see init_instrument).
+#ifdef OKX_FIXED_UNIVERSE
+inst_id_t intern_instrument(const char *instrument, int expected) {
+    size_t len = strlen(instrument);
+    // The generated hash already fixes the id; only initialize the entry once.
+    inst_id_t id = intern_lookup(instrument, len);
+    if (id == INST_ID_NONE) {
+        fprintf(stderr, "%s is not in the fixed symbol list\n", instrument);
+        return INST_ID_NONE;
+    }
+    if (instruments[id].instrument_len == 0) {
+        if (init_instrument(id, instrument, len, expected, 0) != 0)
+            exit(1);
+        instruments[id].state = INST_ACTIVE;
+        instruments[id].shard = id / INSTRUMENTS_PER_CONN;
+        num_instruments++;
+    }
+    return id;
+}
+#else
+// Enter an instrument's id into the lookup table.
+static void intern_insert(inst_id_t id) {
+    uint32_t slot = intern_hash(instruments[id].instrument, instruments[id].instrument_len) & (INTERN_TABLE_SIZE - 1);
+    while (intern_table[slot])
+        slot = (slot + 1) & (INTERN_TABLE_SIZE - 1);
+    intern_table[slot] = id + 1;
+}
+
+// Rebuild the lookup table from the active instruments, after one was removed (linear
+// probing has no cheap delete). Called on the network thread with ma_mutex held; other
+// threads (the --conflate ingest thread) only look up under ma_mutex.
+static void intern_rebuild(void) {
+    memset(intern_table, 0, sizeof(intern_table));
+    for (int i = 0; i < num_instruments; i++) {
+        if (instruments[i].state == INST_ACTIVE)
+            intern_insert((inst_id_t)i);
+    }
+}
+
+inst_id_t intern_instrument(const char *instrument, int expected) {
+    size_t len = strlen(instrument);
+    inst_id_t existing = intern_lookup(instrument, len);
+    if (existing != INST_ID_NONE)
+        return existing;
+    if (len >= sizeof(instruments[0].instrument)) {
+        fprintf(stderr, "Instrument name too long: %s\n", instrument);
+        return INST_ID_NONE;
+    }
+    if (num_instruments < MAX_INSTRUMENTS) {
+        inst_id_t id = (inst_id_t)num_instruments;
+        if (init_instrument(id, instrument, len, expected, 0) != 0)
+            exit(1);
+        instruments[id].state = INST_ACTIVE;
+        instruments[id].shard = id / INSTRUMENTS_PER_CONN;
+        intern_insert(id);
+        num_instruments++;
+        return id;
+    }
+    fprintf(stderr, "Too many instruments!\n");
+    return INST_ID_NONE;
+}
+#endif
+
+// --------------------- Pearson Correlation Function ---------------------
+// Compute Pearson correlation coefficient for two vectors of length n. If max_index is not
+// NULL it receives the index k with the largest |(v1[k] - mean1) * (v2[k] - mean2)|, i.e.
+// the sample contributing most to the correlation.
+KERNEL_IMPL double pearson_corr_vector_impl(const double *v1, const double *v2, int n, int *max_index) {
+    if (n < 2)
+        return NAN;
+    double sum1 = 0, sum2 = 0;
+    for (int i = 0; i < n; i++) {
+        sum1 += v1[i];
+        sum2 += v2[i];
+    }
+    double mean1 = sum1 / n;
+    double mean2 = sum2 / n;
+    double num = 0, den1 = 0, den2 = 0, max_contrib = -1.0;
+    for (int i = 0; i < n; i++) {
+        double d1 = v1[i] - mean1;
+        double d2 = v2[i] - mean2;
+        double prod = d1 * d2;
+        num += prod;
+        den1 += d1 * d1;
+        den2 += d2 * d2;
+        if (fabs(prod) > max_contrib) {
+            max_contrib = fabs(prod);
+            if (max_index)
+                *max_index = i;
+        }
+    }
+    if (den1 == 0 || den2 == 0)
+        return NAN;
+    return num / sqrt(den1 * den2);
+}
+MULTIVERSION(double, pearson_corr_vector, (const double *v1, const double *v2, int n, int *max_index),
+             (v1, v2, n, max_index))
+
+// Fixed-length specializations of pearson_corr_vector. The constant trip count lets the
+// compiler fully unroll both passes and keep the accumulators in (vector) registers.
+#define DEFINE_PEARSON_KERNEL(N)                                                        \
+KERNEL_IMPL double pearson_corr_##N##_impl(const double *restrict v1,                  \
+                                           const double *restrict v2, int *max_index) {\
+    double sum1 = 0, sum2 = 0;                                                          \
+    _Pragma("GCC unroll 64")                                                            \
+    for (int i = 0; i < N; i++) {                                                       \
+        sum1 += v1[i];                                                                  \
+        sum2 += v2[i];                                                                  \
+    }                                                                                   \
+    double mean1 = sum1 / N;                                                            \
+    double mean2 = sum2 / N;                                                            \
+    double d1[N], d2[N], prod[N];                                                       \
+    _Pragma("GCC unroll 64")                                                            \
+    for (int i = 0; i < N; i++) {                                                       \
+        d1[i] = v1[i] - mean1;                                                          \
+        d2[i] = v2[i] - mean2;                                                          \
+        prod[i] = d1[i] * d2[i];                                                        \
+    }                                                                                   \
+    double num = 0, den1 = 0, den2 = 0, max_contrib = -1.0;                             \
+    int best = 0;                                                                       \
+    _Pragma("GCC unroll 64")                                                            \
+    for (int i = 0; i < N; i++) {                                                       \
+        num += prod[i];                                                                 \
+        den1 += d1[i] * d1[i];                                                          \
+        den2 += d2[i] * d2[i];                                                          \
+        if (fabs(prod[i]) > max_contrib) {                                              \
+            max_contrib = fabs(prod[i]);                                                \
+            best = i;                                                                   \
+        }                                                                               \
+    }                                                                                   \
+    if (max_index)                                                                      \
+        *max_index = best;                                                              \
+    if (den1 == 0 || den2 == 0)                                                         \
+        return NAN;                                                                     \
+    return num / sqrt(den1 * den2);                                                     \
+}                                                                                       \
+MULTIVERSION(double, pearson_corr_##N, (const double *v1, const double *v2, int *max_index), \
+             (v1, v2, max_index))
+
+DEFINE_PEARSON_KERNEL(8)
+DEFINE_PEARSON_KERNEL(15)
+DEFINE_PEARSON_KERNEL(16)
+DEFINE_PEARSON_KERNEL(32)
+DEFINE_PEARSON_KERNEL(60)
+
+// Dispatch table of the specialized kernels, indexed by window length.
+#define PEARSON_MAX_FIXED 60
+typedef double (*pearson_kernel_t)(const double *, const double *, int *);
+static const pearson_kernel_t pearson_kernels[PEARSON_MAX_FIXED + 1] = {
+    [8] = pearson_corr_8,
+    [15] = pearson_corr_15,
+    [16] = pearson_corr_16,
+    [32] = pearson_corr_32,
+    [60] = pearson_corr_60,
+};
+
+// Pearson correlation plus max-contribution index, using a specialized kernel when one
+// exists for n. With a constant n (e.g. MA_HISTORY_SIZE) the lookup folds to a direct call.
+static inline double pearson_corr(const double *v1, const double *v2, int n, int *max_index) {
+    if (n >= 0 && n <= PEARSON_MAX_FIXED && pearson_kernels[n])
+        return pearson_kernels[n](v1, v2, max_index);
+    return pearson_corr_vector(v1, v2, n, max_index);
+}
+
+// --------------------- Data Structures for Correlation Computation ---------------------
+// This structure holds the most recent MA values and a mapping to the global instruments array.
+typedef struct {
+    inst_id_t id;                // Id of the instrument in the global instruments array.
+    uint32_t stale_mask;         // Bit k set: ma[k] is carried forward (MA_HISTORY_SIZE <= 32)
+    ma_entry_t ma[MA_HISTORY_SIZE];
+} corr_data_t;
+
+// Thread argument for correlation computation.
+typedef struct {
+    int index;          // First index in the corr_data_t array for which to compute correlation.
+    int stride;         // Distance to the next index handled by the same thread.
+    int total;          // Total number of instruments with complete MA history.
+    corr_data_t *data;  // Array of correlation data.
+    double current_time; // Current computation time.
+} corr_thread_arg_t;
+
+// Compute the correlations of one instrument against all others.
+static void compute_corr_one(const corr_thread_arg_t *ct_arg, int idx) {
+    int total = ct_arg->total;
+    double max_corr = -2.0;
+    inst_id_t max_id = INST_ID_NONE;
+    double max_ma_time = 0; // Timestamp of the MA value that maximizes the correlation
+    int max_ma_index = -1;  // Index of the MA value that maximizes the correlation
+
+    // Extract the moving average values of this instrument once.
+    double ma1[MA_HISTORY_SIZE], ma2[MA_HISTORY_SIZE];
+    for (int k = 0; k < MA_HISTORY_SIZE; k++)
+        ma1[k] = ct_arg->data[idx].ma[k].moving_avg;
+
+    // Pairs involving a carried-forward MA on either side are not computed at all.
+    uint32_t mask = ct_arg->data[idx].stale_mask;
+    int skipped = 0;
+    for (int j = 0; j < total; j++) {
+        if (j == idx)
+            continue;
+        if (mask | ct_arg->data[j].stale_mask) {
+            skipped++;
+            continue;
+        }
+
+        for (int k = 0; k < MA_HISTORY_SIZE; k++)
+            ma2[k] = ct_arg->data[j].ma[k].moving_avg;
+
+        // Compute Pearson correlation and the MA value contributing most to it in one call
+        int contrib_index = -1;
+        double corr = pearson_corr(ma1, ma2, MA_HISTORY_SIZE, &contrib_index);
+
+        // Update max correlation and corresponding timestamp
+        if (!isnan(corr) && corr > max_corr) {
+            max_corr = corr;
+            max_id = ct_arg->data[j].id;
+            max_ma_index = contrib_index;
+
+            // Store the timestamp of the MA value that maximizes the correlation
+            if (max_ma_index != -1) {
+                max_ma_time = ct_arg->data[idx].ma[max_ma_index].timestamp;
+            }
+        }
+    }
+
+    // Update the corresponding global instrument using the stored id
+    inst_id_t global_idx = ct_arg->data[idx].id;
+    pthread_mutex_lock(&ma_mutex);
+    if (!INSTRUMENT_ACTIVE(global_idx)) {  // Removed over --control since the snapshot
+        pthread_mutex_unlock(&ma_mutex);
+        return;
+    }
+    if (max_id != INST_ID_NONE && !INSTRUMENT_ACTIVE(max_id)) {  // The match was removed meanwhile
+        max_id = INST_ID_NONE;
+        max_corr = -2.0;
+        max_ma_time = 0;
+    }
+
+    inst_hot[global_idx].max_corr_id = max_id;
+    inst_hot[global_idx].max_corr = max_corr;
+    instruments[global_idx].max_corr_time = ct_arg->current_time; // Timestamp when max correlation was computed
+    instruments[global_idx].max_corr_ma_time = max_ma_time;      // Timestamp of the MA value that maximizes the correlation
+
+    // Log the correlation result
+    if (instruments[global_idx].corr_file) {
+        char timestamp[20];
+        time_t current_time = (time_t)ct_arg->current_time;
+        struct tm *tm_info = localtime(&current_time);
+        strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
+
+        char ma_timestamp[20];
+        time_t ma_time = (time_t)max_ma_time;
+        struct tm *ma_tm_info = localtime(&ma_time);
+        strftime(ma_timestamp, sizeof(ma_timestamp), "%Y-%m-%d %H:%M:%S", ma_tm_info);
+
+        // Stale minutes of this instrument, oldest first ('1': carried forward).
+        char stale_mask[MA_HISTORY_SIZE + 1];
+        for (int k = 0; k < MA_HISTORY_SIZE; k++)
+            stale_mask[k] = (mask >> k & 1) ? '1' : '0';
+        stale_mask[MA_HISTORY_SIZE] = '\0';
+
+        out_printf(instruments[global_idx].corr_file, "%s,%s,%.4f,%s,%s,%d\n",
+                timestamp, // Timestamp when max correlation was computed
+                (max_id != INST_ID_NONE) ? instruments[max_id].instrument : "N/A",
+                inst_hot[global_idx].max_corr,
+                ma_timestamp, // Human-readable timestamp of the MA value
+                stale_mask, skipped);
+    }
+
+    pthread_mutex_unlock(&ma_mutex);
+}
+
+// Thread function to compute correlations for every stride-th instrument.
+void *compute_corr_thread(void *arg) {
+    corr_thread_arg_t *ct_arg = (corr_thread_arg_t *)arg;
+    for (int idx = ct_arg->index; idx < ct_arg->total; idx += ct_arg->stride)
+        compute_corr_one(ct_arg, idx);
+    free(ct_arg);
+    return NULL;
+}
+
+// --------------------- Compressed Trade Window ---------------------
+// In --window compressed mode new trades land in the small uncompressed head. When the
+// head is full it is sealed into a trade_block_t (format in okx_journal.h) that is kept
+// in memory for the window scan and appended to the instrument's trades.journal.
+
+static inline int64_t seconds_to_ns(double t) {
+    return llround(t * 1e9);
+}
+
+// Encode trades[0..n) of instrument id into a block header and payload.
+static size_t encode_trades(inst_id_t id, const trade_t *trades, int n,
+                            journal_block_hdr_t *hdr, uint8_t *payload) {
+    journal_encoder_t enc;
+    int64_t first_ts = seconds_to_ns(trades[0].timestamp);
+    journal_encoder_init(&enc, payload, first_ts);
+    for (int i = 0; i < n; i++)
+        journal_encode_trade(&enc, seconds_to_ns(trades[i].timestamp), trades[i].price,
+                             trades[i].volume, seconds_to_ns(trades[i].delay));
+    return journal_encoder_finish(&enc, hdr, first_ts, inst_hot[id].price_decimals,
+                                  inst_hot[id].size_decimals);
+}
+
+// Move the full head of instrument id into a new compressed block (called with ma_mutex held).
+static void seal_trade_head(inst_id_t id) {
+    static uint8_t scratch[TRADE_HEAD_SIZE * JOURNAL_MAX_TRADE_BYTES];
+    inst_hot_t *hot = &inst_hot[id];
+    moving_avg_t *inst = &instruments[id];
+    const trade_t *trades = inst_trades[id];
+    int n = hot->trade_count;
+    if (n == 0)
+        return;
+
+    journal_block_hdr_t hdr;
+    size_t bytes = encode_trades(id, trades, n, &hdr, scratch);
+    trade_block_t *block = malloc(sizeof(*block) + bytes);
+    if (!block) {
+        fprintf(stderr, "[ERROR] Could not allocate trade block for %s\n", inst->instrument);
+        return;
+    }
+    block->next = NULL;
+    block->min_ts = trades[0].timestamp;
+    block->max_ts = trades[n - 1].timestamp;
+    block->sum_price = 0;
+    block->sum_volume = 0;
+    block->sum_delay = 0;
+    block->expired = 0;
+    for (int i = 0; i < n; i++) {
+        block->sum_price += trades[i].price;
+        block->sum_volume += trades[i].volume;
+        block->sum_delay += trades[i].delay;
+    }
+    block->hdr = hdr;
+    memcpy(block->data, scratch, bytes);
+
+    if (inst->blocks_tail)
+        inst->blocks_tail->next = block;
+    else
+        inst->blocks = block;
+    inst->blocks_tail = block;
+    inst->block_count++;
+    hot->block_trades += n;
+    hot->trade_count = 0;
+
+    out_index(inst->journal_idx, block->min_ts, out_tell(inst->journal_file));
+    out_write(inst->journal_file, (const char *)&hdr, sizeof(hdr));
+    out_write(inst->journal_file, (const char *)block->data, bytes);
+}
+
+// Append the trades still in the head to the journal (at shutdown), leaving the window as is.
+static void journal_flush_head(inst_id_t id) {
+    static uint8_t scratch[TRADE_HEAD_SIZE * JOURNAL_MAX_TRADE_BYTES];
+    int n = inst_hot[id].trade_count;
+    if (options.window != WINDOW_COMPRESSED || n == 0 || !instruments[id].journal_file)
+        return;
+    journal_block_hdr_t hdr;
+    size_t bytes = encode_trades(id, inst_trades[id], n, &hdr, scratch);
+    out_index(instruments[id].journal_idx, inst_trades[id][0].timestamp,
+              out_tell(instruments[id].journal_file));
+    out_write(instruments[id].journal_file, (const char *)&hdr, sizeof(hdr));
+    out_write(instruments[id].journal_file, (const char *)scratch, bytes);
+}
+
+// Double a flat window that filled up before the minute pass could trim it, up to
+// TRADE_BUFFER_SIZE (called with ma_mutex held). Only windows sized below the maximum
+// from an activity estimate (--discover) ever grow.
+static void grow_trade_window(inst_id_t id) {
+    inst_hot_t *hot = &inst_hot[id];
+    int capacity = hot->capacity * 2 < TRADE_BUFFER_SIZE ? hot->capacity * 2 : TRADE_BUFFER_SIZE;
+    trade_t *trades = window_alloc(capacity);
+    if (!trades) {
+        fprintf(stderr, "[ERROR] Could not grow the trade window of %s\n", instruments[id].instrument);
+        return;
+    }
+    memcpy(trades, inst_trades[id], (size_t)hot->trade_count * sizeof(trade_t));
+    window_free(inst_trades[id], hot->capacity);
+    inst_trades[id] = trades;
+    hot->capacity = capacity;
+}
+
+// --------------------- Receive Timestamps ---------------------
+// With --rx-timestamps the kernel stamps every received segment (SO_TIMESTAMPING, software
+// receive stamps). The main loop peeks the stamp of the next unread segment of each socket
+// before it lets libwebsockets read them (service_with_rx_timestamps), so each frame
+// carries the time its bytes reached the kernel; save_trade then records kernel-to-callback
+// and kernel-to-stored latencies per instrument. Both clocks are CLOCK_REALTIME.
+typedef enum {
+    RX_KERNEL_TO_CALLBACK,   // Segment received by the kernel -> LWS_CALLBACK_CLIENT_RECEIVE
+    RX_KERNEL_TO_STORED,     // Segment received by the kernel -> trade stored in the window
+    RX_LATENCY_KINDS
+} rx_latency_kind_t;
+
+static const char *rx_latency_names[RX_LATENCY_KINDS] = { "kernel_to_callback", "kernel_to_stored" };
+
+#define LATENCY_SUB (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * LATENCY_SUB)
+
+// Latency histogram in nanoseconds; bucket widths grow with the value (12.5% resolution).
+typedef struct {
+    uint64_t count;
+    uint64_t max_ns;
+    uint32_t buckets[LATENCY_BUCKETS];
+} latency_hist_t;
+
+static latency_hist_t rx_latency[MAX_INSTRUMENTS][RX_LATENCY_KINDS] CACHE_ALIGNED;  // Under ma_mutex
+static double frame_kernel_time = 0;   // Kernel receive time of the frame being handled (0 if unknown)
+static double frame_callback_time = 0; // Time the receive callback was entered
+
+static inline int latency_bucket(uint64_t ns) {
+    if (ns < LATENCY_SUB)
+        return (int)ns;
+    int msb = 63 - __builtin_clzll(ns);
+    int idx = (msb - LATENCY_SUB_BITS + 1) * LATENCY_SUB +
+              (int)((ns >> (msb - LATENCY_SUB_BITS)) & (LATENCY_SUB - 1));
+    return idx < LATENCY_BUCKETS ? idx : LATENCY_BUCKETS - 1;
+}
+
+// Largest latency that falls into bucket idx.
+static uint64_t latency_bucket_upper(int idx) {
+    if (idx < LATENCY_SUB)
+        return (uint64_t)idx;
+    int shift = idx / LATENCY_SUB - 1;
+    uint64_t lower = (uint64_t)(LATENCY_SUB + idx % LATENCY_SUB) << shift;
+    return lower + (1ULL << shift) - 1;
+}
+
+static inline void latency_record(latency_hist_t *h, double seconds) {
+    uint64_t ns = seconds > 0 ? (uint64_t)(seconds * 1e9) : 0;  // Clock steps can go negative
+    h->buckets[latency_bucket(ns)]++;
+    h->count++;
+    if (ns > h->max_ns)
+        h->max_ns = ns;
+}
+
+// Latency below which the fraction q of the samples lies (bucket upper bound), in ns.
+static uint64_t latency_percentile(const latency_hist_t *h, double q) {
+    uint64_t rank = (uint64_t)ceil(q * h->count), seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank && seen > 0) {
+            uint64_t upper = latency_bucket_upper(i);
+            return upper < h->max_ns ? upper : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+// Ask the kernel to timestamp received segments on the websocket.
+static void enable_rx_timestamps(int fd) {
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) != 0)
+        printf(KRED "[WebSocket] SO_TIMESTAMPING unavailable: %s\n" RESET, strerror(errno));
+    else
+        printf(KGRN "[WebSocket] Kernel receive timestamps enabled\n" RESET);
+}
+
+// Kernel receive time of the next unread segment, without consuming it; 0 if none.
+static double peek_rx_timestamp(int fd) {
+    char byte;
+    char control[CMSG_SPACE(sizeof(struct scm_timestamping))];
+    struct iovec iov = { &byte, 1 };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(fd, &msg, MSG_PEEK | MSG_DONTWAIT) <= 0)
+        return 0;
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPING) {
+            struct scm_timestamping ts;
+            memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            return ts.ts[0].tv_sec + ts.ts[0].tv_nsec / 1e9;
+        }
+    }
+    return 0;
+}
+
+// Write the last minute's receive latency percentiles per instrument and start over.
+void report_rx_latency(double now) {
+    static latency_hist_t snapshot[MAX_INSTRUMENTS][RX_LATENCY_KINDS];
+    pthread_mutex_lock(&ma_mutex);
+    size_t used = (size_t)num_instruments * sizeof(rx_latency[0]);  // Not all MAX_INSTRUMENTS rows
+    memcpy(snapshot, rx_latency, used);
+    memset(rx_latency, 0, used);
+    pthread_mutex_unlock(&ma_mutex);
+
+    char timestamp[20];
+    time_t now_int = (time_t)now;
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", localtime(&now_int));
+    for (int i = 0; i < num_instruments; i++) {
+        for (int k = 0; k < RX_LATENCY_KINDS; k++) {
+            const latency_hist_t *h = &snapshot[i][k];
+            if (h->count == 0)
+                continue;
+            double p50 = latency_percentile(h, 0.50) / 1e3;
+            double p90 = latency_percentile(h, 0.90) / 1e3;
+            double p99 = latency_percentile(h, 0.99) / 1e3;
+            double max = h->max_ns / 1e3;
+            if (latency_file)
+                out_printf(latency_file, "%s,%s,%s,%llu,%.3f,%.3f,%.3f,%.3f\n",
+                           timestamp, instruments[i].instrument, rx_latency_names[k],
+                           (unsigned long long)h->count, p50, p90, p99, max);
+            printf(KBLU "[Latency] %s %s: n=%llu p50=%.1f us p90=%.1f us p99=%.1f us max=%.1f us\n" RESET,
+                   instruments[i].instrument, rx_latency_names[k], (unsigned long long)h->count,
+                   p50, p90, p99, max);
+        }
+    }
+}
+
+// --------------------- Busy Polling ---------------------
+// --busy-poll CPU pins the network (main) thread to CPU and replaces the 50 ms poll sleep
+// with non-blocking service calls in a tight loop, so frames are handled as soon as the
+// kernel has them rather than after a scheduler wake-up, at the cost of one busy core.
+
+// Pin the calling thread to one CPU.
+static int pin_thread_to_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0)
+        printf(KRED "[Main] Could not pin to CPU %d: %s\n" RESET, cpu, strerror(rc));
+    return rc;
+}
+
+// Let non-blocking reads on fd poll the device queue for up to usecs (SO_BUSY_POLL;
+// raising it above net.core.busy_read needs CAP_NET_ADMIN).
+static void enable_busy_poll(int fd, int usecs) {
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) != 0)
+        printf(KRED "[WebSocket] SO_BUSY_POLL unavailable: %s\n" RESET, strerror(errno));
+    else
+        printf(KGRN "[WebSocket] SO_BUSY_POLL set to %d us\n" RESET, usecs);
+}
+
+// --------------------- Socket Tuning ---------------------
+// TCP options of the websocket socket (--tcp-nodelay, --rcvbuf, --quickack) and kernel TLS
+// (--ktls). They are applied in LWS_CALLBACK_CONNECTING, before connect(), so that
+// SO_RCVBUF also sizes the window advertised in the handshake.
+static uint64_t frames_received = 0;  // Frames handed to the receive callback
+
+static void tune_socket(int fd) {
+    int one = 1;
+    if (options.tcp_nodelay && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) != 0)
+        printf(KRED "[WebSocket] TCP_NODELAY failed: %s\n" RESET, strerror(errno));
+    if (options.rcvbuf > 0) {
+        int size = options.rcvbuf, actual = 0;
+        socklen_t len = sizeof(actual);
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) != 0)
+            printf(KRED "[WebSocket] SO_RCVBUF failed: %s\n" RESET, strerror(errno));
+        else if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &actual, &len) == 0)
+            printf(KGRN "[WebSocket] SO_RCVBUF %d bytes (kernel doubles the request, capped by rmem_max)\n" RESET,
+                   actual);
+    }
+    if (options.quickack)
+        setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+}
+
+// TCP_QUICKACK is not sticky: the kernel drops back to delayed ACKs, so it is set again
+// after each frame to acknowledge every segment at once.
+static inline void rearm_quickack(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+}
+
+// Ask OpenSSL to move the record layer into the kernel once the handshake is done.
+static void enable_ktls(SSL_CTX *ctx) {
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#else
+    (void)ctx;
+    printf(KRED "[WebSocket] kTLS requested but OpenSSL was built without it\n" RESET);
+#endif
+}
+
+// Whether the receive side of the connection actually runs in kernel TLS: it needs the
+// tls module, an AES-GCM (or ChaCha20 on newer kernels) suite and OpenSSL with enable-ktls.
+static void report_ktls(struct lws *wsi) {
+#ifdef BIO_CTRL_GET_KTLS_RECV
+    SSL *ssl = lws_get_ssl(wsi);
+    if (!ssl)
+        return;
+    int rx = BIO_get_ktls_recv(SSL_get_rbio(ssl)) > 0;
+    int tx = BIO_get_ktls_send(SSL_get_wbio(ssl)) > 0;
+    printf("%s[WebSocket] kTLS receive %s, send %s (%s)\n" RESET, rx ? KGRN : KRED,
+           rx ? "on" : "off", tx ? "on" : "off", SSL_get_cipher_name(ssl));
+#else
+    (void)wsi;
+#endif
+}
+
+// CPU time of the calling (network) thread in seconds.
+static void thread_cpu_time(double *user, double *sys) {
+    struct rusage ru;
+    getrusage(RUSAGE_THREAD, &ru);
+    *user = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+    *sys = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+// --------------------- Trade Logging ---------------------
+// Parse JSON trade data, use clock_gettime for high-resolution timing, and log each trade.
+// Returns the number of trades stored.
+int save_trade(const char *json_str, size_t json_len) {
+    json_t *root, *data_array, *data_obj, *price_obj, *vol_obj, *instId_obj, *trade_id_obj;
+    json_error_t error;
+
+    int stored = 0;
+
+    root = json_loadb(json_str, json_len, 0, &error);
+    if (!root) {
+        fprintf(stderr, "JSON Parsing Error: %s\n", error.text);
+        return 0;
+    }
+    data_array = json_object_get(root, "data");
+    if (!json_is_array(data_array)) {
+        json_decref(root);
+        return 0;
+    }
+    size_t index;
+    for (index = 0; index < json_array_size(data_array); index++) {
+        data_obj = json_array_get(data_array, index);
+        price_obj = json_object_get(data_obj, "last");
+        if (!price_obj)
+            price_obj = json_object_get(data_obj, "px");  // trades channel
+        // Use "vol" if available; otherwise, fallback to "lastSz" (or the trade's "sz").
+        vol_obj = json_object_get(data_obj, "vol");
+        if (!vol_obj)
+            vol_obj = json_object_get(data_obj, "lastSz");
+        if (!vol_obj)
+            vol_obj = json_object_get(data_obj, "sz");
+        instId_obj = json_object_get(data_obj, "instId");
+        trade_id_obj = json_object_get(data_obj, "tradeId");  // trades channel
+        if (json_is_string(price_obj) && json_is_string(vol_obj) && json_is_string(instId_obj)) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            double now = ts.tv_sec + ts.tv_nsec / 1e9;
+
+            // Looked up under ma_mutex: with --conflate this runs on the ingest thread,
+            // while --control changes the table on the network thread.
+            pthread_mutex_lock(&ma_mutex);
+            inst_id_t id = intern_lookup(json_string_value(instId_obj), json_string_length(instId_obj));
+            if (id == INST_ID_NONE) {
+                pthread_mutex_unlock(&ma_mutex);
+                continue;  // Not one of the subscribed instruments.
+            }
+            inst_hot_t *hot = &inst_hot[id];
+            moving_avg_t *entry = &instruments[id];
+            int64_t price, vol;
+            int valid = parse_decimal_fx(json_string_value(price_obj), hot->price_decimals, &price) == 0 &&
+                        parse_decimal_fx(json_string_value(vol_obj), hot->size_decimals, &vol) == 0;
+            if (!valid)
+                fprintf(stderr, "[ERROR] Malformed price/volume for %s\n", entry->instrument);
+
+            // A push repeating the latest trade (tickers resent with only 24h stats changed,
+            // or a trade delivered twice) is dropped or marked as configured per channel.
+            int64_t trade_id = json_is_string(trade_id_obj) ? strtoll(json_string_value(trade_id_obj), NULL, 10) : 0;
+            int repeat = valid && hot->dedup != DEDUP_OFF && hot->ticks_total > 0 && price == hot->last_price &&
+                         vol == hot->last_volume && trade_id == hot->last_trade_id;
+            if (repeat) {
+                hot->repeats++;
+                if (hot->dedup == DEDUP_DROP) {
+                    // Still a sign of life for the staleness check.
+                    hot->tick_interval = 0.9 * hot->tick_interval + 0.1 * (now - hot->last_trade_time);
+                    hot->last_trade_time = now;
+                    pthread_mutex_unlock(&ma_mutex);
+                    continue;
+                }
+            }
+            if (valid && hot->trade_count == hot->capacity) {
+                if (options.window == WINDOW_COMPRESSED)
+                    seal_trade_head(id);
+                else if (hot->capacity < TRADE_BUFFER_SIZE)
+                    grow_trade_window(id);
+            }
+            if (valid && hot->trade_count < hot->capacity &&
+                hot->trade_count + hot->block_trades < TRADE_BUFFER_SIZE) {
+                trade_t *trade = &inst_trades[id][hot->trade_count];
+                trade->timestamp = now;
+                trade->price = price;
+                trade->volume = vol;
+            
+                // Compute processing delay.
+                struct timespec ts2;
+                clock_gettime(CLOCK_REALTIME, &ts2);
+                double current = ts2.tv_sec + ts2.tv_nsec / 1e9;
+                double delay = current - now;
+                trade->delay = delay;
+
+                if (hot->ticks_total > 0) {
+                    double interval = now - hot->last_trade_time;
+                    hot->tick_interval = hot->tick_interval > 0 ? 0.9 * hot->tick_interval + 0.1 * interval
+                                                                : interval;
+                }
+                hot->trade_count++;
+                hot->ticks_total++;
+                hot->last_price = price;
+                hot->last_volume = vol;
+                hot->last_trade_id = trade_id;
+                hot->last_trade_time = now;
+                stored++;
+                if (frame_kernel_time > 0) {
+                    latency_record(&rx_latency[id][RX_KERNEL_TO_CALLBACK], frame_callback_time - frame_kernel_time);
+                    latency_record(&rx_latency[id][RX_KERNEL_TO_STORED], current - frame_kernel_time);
+                }
+
+                char price_str[32], vol_str[32];
+                format_decimal_fx(price_str, sizeof(price_str), price, hot->price_decimals);
+                format_decimal_fx(vol_str, sizeof(vol_str), vol, hot->size_decimals);
+
+                // Log the trade to the transactions file
+                if (entry->trans_file) {
+                    char timestamp[20];
+                    time_t trade_time = (time_t)now;
+                    struct tm *tm_info = localtime(&trade_time);
+                    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
+
+                    if (entry->trans_rows++ % INDEX_STRIDE == 0)
+                        out_index(entry->trans_idx, now, out_tell(entry->trans_file));
+                    if (dedup_marking())
+                        out_printf(entry->trans_file, "%s,%s,%s,%.9f,%d\n",
+                                   timestamp, price_str, vol_str, delay, repeat);
+                    else
+                        out_printf(entry->trans_file, "%s,%s,%s,%.9f\n",
+                                   timestamp, price_str, vol_str, delay);
+                }
+                printf(KYEL "[Transaction] %s - Price=%s, Vol=%s, Processing Delay=%.6f sec\n" RESET, entry->instrument, price_str, vol_str, delay);
+            }
+            pthread_mutex_unlock(&ma_mutex);
+        }
+    }
+    json_decref(root);
+    return stored;
+}
+
+// Repeated pushes per instrument, printed on exit when --dedup is on.
+static void report_dedup(void) {
+    if (options.dedup_tickers == DEDUP_OFF && options.dedup_trades == DEDUP_OFF)
+        return;
+    static const char *dedup_names[] = { "off", "dropped", "marked" };
+    uint64_t repeats[3] = { 0, 0, 0 };
+    for (int i = 0; i < num_instruments; i++)
+        repeats[inst_hot[i].dedup] += inst_hot[i].repeats;
+    printf(KGRN "[Dedup] repeated pushes: %llu dropped, %llu marked\n" RESET,
+           (unsigned long long)repeats[DEDUP_DROP], (unsigned long long)repeats[DEDUP_MARK]);
+    for (int i = 0; i < num_instruments; i++) {
+        const inst_hot_t *hot = &inst_hot[i];
+        if (INSTRUMENT_ACTIVE(i) && hot->repeats > 0)
+            printf("[Dedup] %-10s %llu of %llu pushes %s\n", instruments[i].instrument,
+                   (unsigned long long)hot->repeats,
+                   (unsigned long long)(hot->ticks_total + (hot->dedup == DEDUP_DROP ? hot->repeats : 0)),
+                   dedup_names[hot->dedup]);
+    }
+}
+
+// --------------------- 15-Minute Moving Average & Volume Computation ---------------------
+// Sums over the trades that remain in the 15-minute window.
+typedef struct {
+    fx_sum_t price;
+    fx_sum_t volume;
+    double delay;
+} window_sums_t;
+
+// Drop trades older than cutoff by compacting the survivors to the front of the array
+// (in place), summing them on the way. Returns the number of trades kept.
+KERNEL_IMPL int window_scan_impl(trade_t *trades, int count, double cutoff, window_sums_t *sums) {
+    fx_sum_t sum_price = 0, sum_vol = 0;
+    double sum_delay = 0;
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        if (trades[i].timestamp >= cutoff) {
+            sum_price += trades[i].price;
+            sum_vol += trades[i].volume;
+            sum_delay += trades[i].delay;
+            trades[kept++] = trades[i];
+        }
+    }
+    sums->price = sum_price;
+    sums->volume = sum_vol;
+    sums->delay = sum_delay;
+    return kept;
+}
+MULTIVERSION(int, window_scan, (trade_t *trades, int count, double cutoff, window_sums_t *sums),
+             (trades, count, cutoff, sums))
+
+// Add the compressed blocks of instrument id that are still in the window to sums, freeing
+// expired blocks. Only a block straddling the cutoff is decoded; its expired trades are
+// dropped from block_trades so they no longer count against TRADE_BUFFER_SIZE. Returns the
+// trades counted.
+static int scan_trade_blocks(inst_id_t id, double cutoff, window_sums_t *sums) {
+    moving_avg_t *inst = &instruments[id];
+    inst_hot_t *hot = &inst_hot[id];
+    while (inst->blocks && inst->blocks->max_ts < cutoff) {
+        trade_block_t *expired = inst->blocks;
+        inst->blocks = expired->next;
+        hot->block_trades -= expired->hdr.count - expired->expired;
+        inst->block_count--;
+        free(expired);
+    }
+    if (!inst->blocks)
+        inst->blocks_tail = NULL;
+
+    int counted = 0;
+    int64_t cutoff_ns = seconds_to_ns(cutoff);
+    for (trade_block_t *b = inst->blocks; b; b = b->next) {
+        if (b->min_ts >= cutoff) {
+            sums->price += b->sum_price;
+            sums->volume += b->sum_volume;
+            sums->delay += b->sum_delay;
+            counted += b->hdr.count;
+            continue;
+        }
+        journal_cursor_t cur;
+        journal_trade_t t;
+        int kept = 0;
+        journal_cursor_init(&cur, &b->hdr, b->data);
+        while (journal_next(&cur, &t)) {
+            if (t.ts_ns >= cutoff_ns) {
+                sums->price += t.price;
+                sums->volume += t.volume;
+                sums->delay += t.delay_ns / 1e9;
+                kept++;
+            }
+        }
+        counted += kept;
+        hot->block_trades -= b->hdr.count - kept - b->expired;
+        b->expired = b->hdr.count - kept;
+    }
+    return counted;
+}
+
+// Compute average price, total volume, and average delay over trades in the last 15 minutes.
+void compute_moving_avg_and_volume(inst_id_t id, double now, ma_entry_t *ma_out) {
+    inst_hot_t *hot = &inst_hot[id];
+    window_sums_t sums;
+    int count = window_scan(inst_trades[id], hot->trade_count, now - FIFTEEN_MINUTES, &sums);
+    hot->trade_count = count;
+    if (options.window == WINDOW_COMPRESSED)
+        count += scan_trade_blocks(id, now - FIFTEEN_MINUTES, &sums);
+
+    if (count > 0) {
+        ma_out->moving_avg = fx_to_double(sums.price, hot->price_decimals) / count;
+        ma_out->total_volume = fx_to_double(sums.volume, hot->size_decimals);
+        ma_out->avg_delay = sums.delay / count;  // Average processing delay
+        ma_out->stale = 0;
+    } else {
+        // No trade in 15 minutes: keep the last known average (0 before the first one)
+        // and flag it, so that correlations skip it instead of seeing a drop to zero.
+        ma_out->moving_avg = hot->ma_count > 0 ? instruments[id].ma_history[hot->ma_count - 1].moving_avg : 0;
+        ma_out->total_volume = 0;
+        ma_out->avg_delay = 0;
+        ma_out->stale = 1;
+    }
+    ma_out->timestamp = now;
+}
+
+// --------------------- Arrow IPC Export ---------------------
+// With --arrow, every minute pass is also emitted as one Arrow IPC record batch (stream
+// format: schema message first, then one batch per minute) so analytics tools can map the
+// results without parsing CSV. Rows are instruments; columns:
+//   minute (timestamp[ns, UTC]), instrument (utf8), moving_avg, total_volume, avg_delay
+//   (float64), stale (bool: moving_avg carried forward), corr_symbol (utf8, null if none),
+//   correlation (float64, null if none), corr_ma_time (timestamp[ns, UTC], null if none).
+// The flatbuffer metadata is written by a minimal builder below and each message is
+// assembled in a buffer allocated once at startup for MAX_INSTRUMENTS rows. The stream goes
+// to a file through the output writer (rotated segments start with the schema again) or
+// to the consumers connected to a Unix socket (unix:PATH).
+
+#define ARROW_COLUMNS 9
+#define ARROW_BUFFERS 20
+
+// Arrow flatbuffer enums (Schema.fbs / Message.fbs).
+#define ARROW_METADATA_V5 4
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_RECORD_BATCH 3
+#define ARROW_TYPE_FLOATING_POINT 3
+#define ARROW_TYPE_UTF8 5
+#define ARROW_TYPE_BOOL 6
+#define ARROW_TYPE_TIMESTAMP 10
+#define ARROW_PRECISION_DOUBLE 2
+#define ARROW_UNIT_NANOSECOND 3
+
+// Flatbuffer under construction; tables are written parent first, children after, so
+// every uoffset points forward.
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+} fb_t;
+
+// One scalar or offset field of a table. Offset fields (size 4) are patched afterwards.
+typedef struct {
+    uint8_t id;
+    uint8_t size;
+    uint64_t value;
+} fb_field_t;
+
+static size_t fb_align(fb_t *b, size_t align) {
+    while (b->len % align)
+        b->buf[b->len++] = 0;
+    return b->len;
+}
+
+static size_t fb_put(fb_t *b, const void *data, size_t n) {
+    size_t pos = b->len;
+    memcpy(b->buf + pos, data, n);
+    b->len += n;
+    return pos;
+}
+
+// Point the uoffset at ref_pos to target.
+static void fb_patch(fb_t *b, size_t ref_pos, size_t target) {
+    uint32_t off = (uint32_t)(target - ref_pos);
+    memcpy(b->buf + ref_pos, &off, 4);
+}
+
+// Write a vtable and its table. pos[id] receives the position of each field.
+static size_t fb_table(fb_t *b, const fb_field_t *fields, int n, size_t *pos) {
+    uint16_t vtable[2 + 8] = { 0 };
+    int max_id = -1, has_long = 0;
+    for (int i = 0; i < n; i++) {
+        if (fields[i].id > max_id)
+            max_id = fields[i].id;
+        has_long |= fields[i].size == 8;
+    }
+    // Layout: soffset to the vtable, then the fields by decreasing size.
+    uint16_t off = has_long ? 8 : 4;
+    for (int size = 8; size >= 1; size /= 2) {
+        for (int i = 0; i < n; i++) {
+            if (fields[i].size == size) {
+                vtable[2 + fields[i].id] = off;
+                off += size;
+            }
+        }
+    }
+    vtable[0] = (uint16_t)(4 + 2 * (max_id + 1));
+    vtable[1] = off;
+
+    fb_align(b, 4);
+    size_t vt = fb_put(b, vtable, vtable[0]);
+    size_t table = fb_align(b, has_long ? 8 : 4);
+    memset(b->buf + table, 0, off);
+    b->len += off;
+    int32_t soffset = (int32_t)(table - vt);
+    memcpy(b->buf + table, &soffset, 4);
+    for (int i = 0; i < n; i++) {
+        size_t at = table + vtable[2 + fields[i].id];
+        memcpy(b->buf + at, &fields[i].value, fields[i].size);  // Little-endian targets only
+        if (pos)
+            pos[fields[i].id] = at;
+    }
+    return table;
+}
+
+static size_t fb_string(fb_t *b, const char *s) {
+    uint32_t len = (uint32_t)strlen(s);
+    size_t pos = fb_align(b, 4);
+    fb_put(b, &len, 4);
+    fb_put(b, s, len + 1);
+    return pos;
+}
+
+// Vector of n uoffsets; element i is at the returned position + 4 + 4 * i.
+static size_t fb_offset_vector(fb_t *b, uint32_t n) {
+    size_t pos = fb_align(b, 4);
+    fb_put(b, &n, 4);
+    memset(b->buf + b->len, 0, 4 * n);
+    b->len += 4 * n;
+    return pos;
+}
+
+// Vector of n 16-byte structs of two int64 (FieldNode, Buffer), 8-aligned elements.
+static size_t fb_struct_vector(fb_t *b, const int64_t (*items)[2], uint32_t n) {
+    fb_align(b, 4);
+    if ((b->len + 4) % 8)
+        fb_put(b, "\0\0\0\0", 4);
+    size_t pos = fb_put(b, &n, 4);
+    fb_put(b, items, 16 * (size_t)n);
+    return pos;
+}
+
+typedef struct {
+    const char *name;
+    uint8_t type;
+    int nullable;
+} arrow_column_t;
+
+static const arrow_column_t arrow_columns[ARROW_COLUMNS] = {
+    { "minute", ARROW_TYPE_TIMESTAMP, 0 },
+    { "instrument", ARROW_TYPE_UTF8, 0 },
+    { "moving_avg", ARROW_TYPE_FLOATING_POINT, 0 },
+    { "total_volume", ARROW_TYPE_FLOATING_POINT, 0 },
+    { "avg_delay", ARROW_TYPE_FLOATING_POINT, 0 },
+    { "stale", ARROW_TYPE_BOOL, 0 },
+    { "corr_symbol", ARROW_TYPE_UTF8, 1 },
+    { "correlation", ARROW_TYPE_FLOATING_POINT, 1 },
+    { "corr_ma_time", ARROW_TYPE_TIMESTAMP, 1 },
+};
+
+static uint8_t *arrow_buf = NULL;         // One message: prefix, metadata, body
+static size_t arrow_buf_size = 0;
+static uint8_t *arrow_schema = NULL;      // Encapsulated schema message
+static size_t arrow_schema_len = 0;
+static out_file_t *arrow_file = NULL;
+static int arrow_listen_fd = -1;
+static char arrow_socket_path[108];
+static int arrow_clients[ARROW_MAX_CLIENTS];
+static int arrow_num_clients = 0;
+
+// Start a Message flatbuffer after the 8-byte IPC prefix; returns the header union slot.
+static size_t arrow_begin_message(fb_t *b, uint8_t *msg, uint8_t header_type, int64_t body_len) {
+    b->buf = msg + 8;
+    b->len = 0;
+    fb_put(b, "\0\0\0\0", 4);  // Root uoffset
+    size_t pos[4];
+    fb_field_t fields[] = {
+        { 0, 2, ARROW_METADATA_V5 },
+        { 1, 1, header_type },
+        { 2, 4, 0 },
+        { 3, 8, (uint64_t)body_len },
+    };
+    size_t message = fb_table(b, fields, 4, pos);
+    fb_patch(b, 0, message);
+    return pos[2];
+}
+
+// Close the metadata: continuation marker, padded metadata length. Returns prefix + metadata size.
+static size_t arrow_end_message(fb_t *b, uint8_t *msg) {
+    fb_align(b, 8);
+    uint32_t marker = 0xFFFFFFFFu;
+    int32_t meta_len = (int32_t)b->len;
+    memcpy(msg, &marker, 4);
+    memcpy(msg + 4, &meta_len, 4);
+    return 8 + b->len;
+}
+
+static size_t arrow_build_schema(uint8_t *msg) {
+    fb_t b;
+    size_t header_slot = arrow_begin_message(&b, msg, ARROW_HEADER_SCHEMA, 0);
+    size_t schema_pos[2];
+    fb_field_t schema_fields[] = { { 1, 4, 0 } };
+    size_t schema = fb_table(&b, schema_fields, 1, schema_pos);
+    fb_patch(&b, header_slot, schema);
+    size_t vec = fb_offset_vector(&b, ARROW_COLUMNS);
+    fb_patch(&b, schema_pos[1], vec);
+
+    for (int c = 0; c < ARROW_COLUMNS; c++) {
+        const arrow_column_t *col = &arrow_columns[c];
+        size_t pos[6];
+        fb_field_t fields[] = {
+            { 0, 4, 0 },
+            { 1, 1, (uint64_t)col->nullable },
+            { 2, 1, col->type },
+            { 3, 4, 0 },
+            { 5, 4, 0 },
+        };
+        size_t field = fb_table(&b, fields, 5, pos);
+        fb_patch(&b, vec + 4 + 4 * c, field);
+        fb_patch(&b, pos[0], fb_string(&b, col->name));
+
+        size_t type, type_pos[2];
+        if (col->type == ARROW_TYPE_TIMESTAMP) {
+            fb_field_t tf[] = { { 0, 2, ARROW_UNIT_NANOSECOND }, { 1, 4, 0 } };
+            type = fb_table(&b, tf, 2, type_pos);
+            fb_patch(&b, type_pos[1], fb_string(&b, "UTC"));
+        } else if (col->type == ARROW_TYPE_FLOATING_POINT) {
+            fb_field_t tf[] = { { 0, 2, ARROW_PRECISION_DOUBLE } };
+            type = fb_table(&b, tf, 1, type_pos);
+        } else {
+            type = fb_table(&b, NULL, 0, NULL);  // Utf8 and Bool have no fields
+        }
+        fb_patch(&b, pos[3], type);
+        fb_patch(&b, pos[5], fb_offset_vector(&b, 0));  // No children
+    }
+    return arrow_end_message(&b, msg);
+}
+
+// Record batch body under construction: buffers are 8-byte aligned.
+typedef struct {
+    uint8_t *base;
+    size_t len;
+    int64_t buffers[ARROW_BUFFERS][2];    // (offset, length) within the body
+    int num_buffers;
+} arrow_body_t;
+
+static uint8_t *arrow_body_begin(arrow_body_t *body) {
+    return body->base + body->len;
+}
+
+static void arrow_body_end(arrow_body_t *body, size_t length) {
+    body->buffers[body->num_buffers][0] = (int64_t)body->len;
+    body->buffers[body->num_buffers][1] = (int64_t)length;
+    body->num_buffers++;
+    body->len += length;
+    while (body->len % 8)
+        body->base[body->len++] = 0;
+}
+
+static void arrow_body_empty(arrow_body_t *body) {
+    arrow_body_end(body, 0);
+}
+
+// Bitmap from valid[0..n): a validity buffer, or the values of a bool column.
+static void arrow_body_bitmap(arrow_body_t *body, const uint8_t *valid, int n) {
+    uint8_t *bits = arrow_body_begin(body);
+    size_t bytes = (size_t)(n + 7) / 8;
+    memset(bits, 0, bytes);
+    for (int i = 0; i < n; i++)
+        if (valid[i])
+            bits[i / 8] |= (uint8_t)(1u << (i % 8));
+    arrow_body_end(body, bytes);
+}
+
+static void arrow_body_values(arrow_body_t *body, const void *values, size_t bytes) {
+    memcpy(arrow_body_begin(body), values, bytes);
+    arrow_body_end(body, bytes);
+}
+
+// Offsets and data buffers of a utf8 column; null entries are empty strings.
+static void arrow_body_strings(arrow_body_t *body, const char *const *strs, int n) {
+    int32_t *offsets = (int32_t *)arrow_body_begin(body);
+    int32_t total = 0;
+    for (int i = 0; i < n; i++) {
+        offsets[i] = total;
+        total += strs[i] ? (int32_t)strlen(strs[i]) : 0;
+    }
+    offsets[n] = total;
+    arrow_body_end(body, 4 * (size_t)(n + 1));
+    char *data = (char *)arrow_body_begin(body);
+    for (int i = 0; i < n; i++) {
+        if (strs[i]) {
+            size_t len = strlen(strs[i]);
+            memcpy(data, strs[i], len);
+            data += len;
+        }
+    }
+    arrow_body_end(body, (size_t)total);
+}
+
+// Send a whole message to every socket consumer, dropping the ones that cannot keep up.
+static void arrow_send_clients(const uint8_t *data, size_t len) {
+    for (int c = 0; c < arrow_num_clients; c++) {
+        ssize_t n = send(arrow_clients[c], data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n != (ssize_t)len) {
+            printf(KRED "[Arrow] Dropping consumer (%s)\n" RESET, n < 0 ? strerror(errno) : "short write");
+            close(arrow_clients[c]);
+            arrow_clients[c--] = arrow_clients[--arrow_num_clients];
+        }
+    }
+}
+
+// Accept pending socket consumers; each starts with the schema.
+static void arrow_accept_clients(void) {
+    int fd;
+    while (arrow_listen_fd >= 0 && (fd = accept4(arrow_listen_fd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+        if (arrow_num_clients == ARROW_MAX_CLIENTS ||
+            send(fd, arrow_schema, arrow_schema_len, MSG_NOSIGNAL) != (ssize_t)arrow_schema_len) {
+            close(fd);
+            continue;
+        }
+        int sndbuf = 1 << 20;
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        arrow_clients[arrow_num_clients++] = fd;
+        printf(KGRN "[Arrow] Consumer connected (%d)\n" RESET, arrow_num_clients);
+    }
+}
+
+// Allocate the message buffer, build the schema and open the file or socket.
+int arrow_open(const char *target) {
+    // Metadata, then the body: per-row data plus up to 8 bytes of padding per buffer.
+    arrow_buf_size = ARROW_META_SIZE + ARROW_BUFFERS * 8 + (size_t)MAX_INSTRUMENTS * ARROW_ROW_BYTES;
+    arrow_buf = malloc(arrow_buf_size);
+    arrow_schema = malloc(ARROW_META_SIZE);
+    if (!arrow_buf || !arrow_schema)
+        return -1;
+    arrow_schema_len = arrow_build_schema(arrow_schema);
+
+    if (strncmp(target, "unix:", 5) == 0) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", target + 5);
+        snprintf(arrow_socket_path, sizeof(arrow_socket_path), "%s", addr.sun_path);
+        unlink(addr.sun_path);
+        arrow_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (arrow_listen_fd < 0 ||
+            bind(arrow_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+            listen(arrow_listen_fd, ARROW_MAX_CLIENTS) != 0) {
+            printf(KRED "[Arrow] Could not listen on %s: %s\n" RESET, addr.sun_path, strerror(errno));
+            return -1;
+        }
+        printf(KGRN "[Arrow] Serving the Arrow IPC stream on %s\n" RESET, addr.sun_path);
+    } else {
+        arrow_file = out_open_bin(target, arrow_schema, arrow_schema_len, 0);
+        if (!arrow_file) {
+            printf(KRED "[Arrow] Could not open %s\n" RESET, target);
+            return -1;
+        }
+        printf(KGRN "[Arrow] Writing the Arrow IPC stream to %s\n" RESET, target);
+    }
+    return 0;
+}
+
+// Emit the results of the minute pass at `now` as one record batch.
+void arrow_export_minute(double now) {
+    if (!arrow_buf)
+        return;
+    arrow_accept_clients();
+    if (!arrow_file && arrow_num_clients == 0)
+        return;
+
+    int n = 0;
+    int64_t minute[MAX_INSTRUMENTS], ma_time[MAX_INSTRUMENTS];
+    double ma[MAX_INSTRUMENTS], volume[MAX_INSTRUMENTS], delay[MAX_INSTRUMENTS], corr[MAX_INSTRUMENTS];
+    const char *names[MAX_INSTRUMENTS], *corr_names[MAX_INSTRUMENTS];
+    uint8_t stale[MAX_INSTRUMENTS], has_corr[MAX_INSTRUMENTS];
+    int nulls = 0;
+
+    pthread_mutex_lock(&ma_mutex);
+    for (int i = 0; i < INSTRUMENT_COUNT; i++) {
+        if (!INSTRUMENT_ACTIVE(i) || inst_hot[i].ma_count == 0)
+            continue;  // Removed, or added after this minute's pass
+        int r = n++;
+        const moving_avg_t *inst = &instruments[i];
+        const ma_entry_t *last = &inst->ma_history[inst_hot[i].ma_count - 1];
+        minute[r] = llround(now * 1e9);
+        names[r] = inst->instrument;
+        ma[r] = last->moving_avg;
+        volume[r] = last->total_volume;
+        delay[r] = last->avg_delay;
+        stale[r] = (uint8_t)last->stale;
+        // Correlations exist only for instruments that took part in this minute's pass.
+        has_corr[r] = inst->max_corr_time == now && inst_hot[i].max_corr_id != INST_ID_NONE;
+        corr_names[r] = has_corr[r] ? instruments[inst_hot[i].max_corr_id].instrument : NULL;
+        corr[r] = has_corr[r] ? inst_hot[i].max_corr : 0;
+        ma_time[r] = has_corr[r] ? llround(inst->max_corr_ma_time * 1e9) : 0;
+        nulls += !has_corr[r];
+    }
+    pthread_mutex_unlock(&ma_mutex);
+
+    // The body goes after the largest possible metadata and is moved down afterwards.
+    arrow_body_t body = { arrow_buf + ARROW_META_SIZE, 0, { { 0 } }, 0 };
+    arrow_body_empty(&body);  arrow_body_values(&body, minute, 8 * (size_t)n);
+    arrow_body_empty(&body);  arrow_body_strings(&body, names, n);
+    arrow_body_empty(&body);  arrow_body_values(&body, ma, 8 * (size_t)n);
+    arrow_body_empty(&body);  arrow_body_values(&body, volume, 8 * (size_t)n);
+    arrow_body_empty(&body);  arrow_body_values(&body, delay, 8 * (size_t)n);
+    arrow_body_empty(&body);  arrow_body_bitmap(&body, stale, n);
+    arrow_body_bitmap(&body, has_corr, n);  arrow_body_strings(&body, corr_names, n);
+    arrow_body_bitmap(&body, has_corr, n);  arrow_body_values(&body, corr, 8 * (size_t)n);
+    arrow_body_bitmap(&body, has_corr, n);  arrow_body_values(&body, ma_time, 8 * (size_t)n);
+
+    int64_t nodes[ARROW_COLUMNS][2];
+    for (int c = 0; c < ARROW_COLUMNS; c++) {
+        nodes[c][0] = n;
+        nodes[c][1] = arrow_columns[c].nullable ? nulls : 0;
+    }
+
+    fb_t b;
+    size_t header_slot = arrow_begin_message(&b, arrow_buf, ARROW_HEADER_RECORD_BATCH, (int64_t)body.len);
+    size_t pos[3];
+    fb_field_t fields[] = { { 0, 8, (uint64_t)n }, { 1, 4, 0 }, { 2, 4, 0 } };
+    size_t batch = fb_table(&b, fields, 3, pos);
+    fb_patch(&b, header_slot, batch);
+    fb_patch(&b, pos[1], fb_struct_vector(&b, (const int64_t (*)[2])nodes, ARROW_COLUMNS));
+    fb_patch(&b, pos[2], fb_struct_vector(&b, (const int64_t (*)[2])body.buffers, (uint32_t)body.num_buffers));
+    size_t meta = arrow_end_message(&b, arrow_buf);
+
+    memmove(arrow_buf + meta, body.base, body.len);
+    size_t total = meta + body.len;
+    out_write(arrow_file, (const char *)arrow_buf, total);
+    arrow_send_clients(arrow_buf, total);
+}
+
+// End the stream (end-of-stream marker) and release the sink.
+void arrow_close(void) {
+    static const uint32_t eos[2] = { 0xFFFFFFFFu, 0 };
+    if (arrow_file) {
+        out_write(arrow_file, (const char *)eos, sizeof(eos));
+        out_close(arrow_file);
+        arrow_file = NULL;
+    }
+    arrow_send_clients((const uint8_t *)eos, sizeof(eos));
+    for (int c = 0; c < arrow_num_clients; c++)
+        close(arrow_clients[c]);
+    arrow_num_clients = 0;
+    if (arrow_listen_fd >= 0) {
+        close(arrow_listen_fd);
+        unlink(arrow_socket_path);
+        arrow_listen_fd = -1;
+    }
+    free(arrow_buf);
+    free(arrow_schema);
+    arrow_buf = NULL;
+}
+
+// --------------------- Per-Minute Pass ---------------------
+// Compute moving averages, update MA history for each instrument, and compute Pearson
+// correlations for the minute ending at `now`.
+void run_minute_pass(double now) {
+    char timestamp[20];
+    time_t now_int = (time_t)now;
+    struct tm *tm_info = localtime(&now_int);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
+
+    pthread_mutex_lock(&ma_mutex);
+    FOR_EACH_INSTRUMENT_UNROLL
+    for (int i = 0; i < INSTRUMENT_COUNT; i++) {
+        if (!INSTRUMENT_ACTIVE(i))
+            continue;
+        ma_entry_t new_ma;
+        compute_moving_avg_and_volume((inst_id_t)i, now, &new_ma);
+        if (inst_hot[i].ma_count < MA_HISTORY_SIZE) {
+            instruments[i].ma_history[inst_hot[i].ma_count] = new_ma;
+            inst_hot[i].ma_count++;
+        } else {
+            for (int k = 1; k < MA_HISTORY_SIZE; k++) {
+                instruments[i].ma_history[k - 1] = instruments[i].ma_history[k];
+            }
+            instruments[i].ma_history[MA_HISTORY_SIZE - 1] = new_ma;
+        }
+        if (instruments[i].ma_file) {
+            if (instruments[i].ma_rows++ % INDEX_STRIDE == 0)
+                out_index(instruments[i].ma_idx, now, out_tell(instruments[i].ma_file));
+            out_printf(instruments[i].ma_file, "%s,%.2f,%.4f,%.9f,%d\n",
+                       timestamp, new_ma.moving_avg, new_ma.total_volume, new_ma.avg_delay, new_ma.stale);
+        }
+    }
+    // Build correlation data array for instruments with complete MA history.
+    // The correlation input is allocated once, for the largest possible universe.
+    static corr_data_t *corr_array = NULL;
+    if (!corr_array) {
+        corr_array = big_alloc(MAX_INSTRUMENTS * sizeof(corr_data_t));
+        if (!corr_array) {
+            pthread_mutex_unlock(&ma_mutex);
+            fprintf(stderr, "Could not allocate correlation buffer\n");
+            return;
+        }
+    }
+    int valid_count = 0;
+    FOR_EACH_INSTRUMENT_UNROLL
+    for (int i = 0; i < INSTRUMENT_COUNT; i++) {
+        if (INSTRUMENT_ACTIVE(i) && inst_hot[i].ma_count >= MA_HISTORY_SIZE) {
+            corr_array[valid_count].id = (inst_id_t)i;
+
+            // Copy the MA history (including timestamps)
+            memcpy(corr_array[valid_count].ma, instruments[i].ma_history, MA_HISTORY_SIZE * sizeof(ma_entry_t));
+            uint32_t mask = 0;
+            for (int k = 0; k < MA_HISTORY_SIZE; k++)
+                mask |= (uint32_t)instruments[i].ma_history[k].stale << k;
+            corr_array[valid_count].stale_mask = mask;
+            valid_count++;
+        }
+    }
+    pthread_mutex_unlock(&ma_mutex);
+
+    // If there is more than one instrument with complete MA history, compute correlations:
+    // one thread per instrument, or per group of instruments beyond one thread per CPU.
+    if (valid_count > 1) {
+        int cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        int num_threads = (cpus > 0 && valid_count > cpus) ? cpus : valid_count;
+        pthread_t threads[num_threads];
+        for (int i = 0; i < num_threads; i++) {
+            corr_thread_arg_t *ct_arg = malloc(sizeof(corr_thread_arg_t));
+            ct_arg->index = i;
+            ct_arg->stride = num_threads;
+            ct_arg->total = valid_count;
+            ct_arg->data = corr_array;
+            ct_arg->current_time = now;
+            pthread_create(&threads[i], NULL, compute_corr_thread, ct_arg);
+        }
+        for (int i = 0; i < num_threads; i++) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    arrow_export_minute(now);
+    out_minute_commit();
+}
+
+// --------------------- Per-Minute Worker Thread ---------------------
+// Every minute, log the scheduled vs. actual start time difference and run the minute pass.
+void *per_minute_worker(void *arg) {
+    (void)arg;
+    while (!destroy_flag) {
+        // Determine actual start time and the scheduled minute boundary.
+        struct timespec ts_start;
+        clock_gettime(CLOCK_REALTIME, &ts_start);
+        double actual_start = ts_start.tv_sec + ts_start.tv_nsec / 1e9;
+        double scheduled = floor(actual_start / 60.0) * 60.0;
+        double time_diff = actual_start - scheduled;
+
+        // Log timing difference.
+        if (timing_file) {
+            char ts_str[20];
+            time_t t_int = ts_start.tv_sec;
+            struct tm *tm_info = localtime(&t_int);
+            strftime(ts_str, sizeof(ts_str), "%Y-%m-%d %H:%M:%S", tm_info);
+            out_printf(timing_file, "%s,%.3f\n", ts_str, time_diff);
+        }
+        printf(KBLU "[Timing] Scheduled vs Actual diff: %.3f sec\n" RESET, time_diff);
+
+
+        // Calculate sleep duration until the next minute.
+        double next_minute = ceil(actual_start / 60.0) * 60.0;
+        double sleep_duration = next_minute - actual_start;
+
+        // Sleep with nanosecond precision.
+        struct timespec sleep_time;
+        sleep_time.tv_sec = (time_t)sleep_duration;
+        sleep_time.tv_nsec = (long)((sleep_duration - sleep_time.tv_sec) * 1e9);
+        nanosleep(&sleep_time, NULL);
+
+
+        // Compute moving averages and correlations.
+        clock_gettime(CLOCK_REALTIME, &ts_start);
+        run_minute_pass(ts_start.tv_sec + ts_start.tv_nsec / 1e9);
+        if (options.rx_timestamps)
+            report_rx_latency(ts_start.tv_sec + ts_start.tv_nsec / 1e9);
+    }
+    return NULL;
+}
+
+// --------------------- CPU Idle Monitor Thread ---------------------
+// Read the aggregate idle and total jiffies from the first line of /proc/stat.
+static int read_cpu_times(unsigned long *idle_out, unsigned long *total_out) {
+    char buffer[256];
+    FILE *fp = fopen("/proc/stat", "r");
+    if (!fp)
+        return -1;
+    int ok = 0;
+    if (fgets(buffer, sizeof(buffer), fp)) {
+        unsigned long user, nice, system, idle, iowait, irq, softirq, steal;
+        ok = sscanf(buffer, "cpu  %lu %lu %lu %lu %lu %lu %lu %lu",
+                    &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal) == 8;
+        *total_out = user + nice + system + idle + iowait + irq + softirq + steal;
+        *idle_out = idle;
+    }
+    fclose(fp);
+    return ok ? 0 : -1;
+}
+
+// Idle percentage between two read_cpu_times samples.
+static double cpu_idle_percent(unsigned long idle0, unsigned long total0,
+                               unsigned long idle1, unsigned long total1) {
+    unsigned long d_total = total1 - total0;
+    return (d_total > 0) ? (100.0 * (idle1 - idle0) / d_total) : 0.0;
+}
+
+// Reads /proc/stat every second, computes the CPU idle percentage, and logs it.
+void *cpu_idle_monitor(void *arg) {
+    (void)arg;
+    unsigned long prev_idle = 0, prev_total = 0;
+
+    cpu_idle_file = out_open("cpu_idle.csv", "Timestamp,IdlePercent\n", 0);
+
+    while (!destroy_flag) {
+        unsigned long idle, total;
+        if (read_cpu_times(&idle, &total) == 0) {
+            if (prev_total != 0) {
+                double idle_percent = cpu_idle_percent(prev_idle, prev_total, idle, total);
+
+                time_t now = time(NULL);
+                char ts[20];
+                struct tm *tm_info = localtime(&now);
+                strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", tm_info);
+                out_printf(cpu_idle_file, "%s,%.3f\n", ts, idle_percent);
+            }
+            prev_total = total;
+            prev_idle = idle;
+        }
+        sleep(1);
+    }
+    out_close(cpu_idle_file);
+    cpu_idle_file = NULL;
+    return NULL;
+}
+
+// --------------------- WebSocket Connections ---------------------
+// Instruments are split into shards of up to INSTRUMENTS_PER_CONN, each subscribed on its
+// own connection (conns_per_shard of them), opened CONNECT_SPACING_MS apart to stay within
+// OKX's connection rate limit. The primary connection of a shard feeds save_trade. With
+// --standby a second connection per shard is kept handshaken and subscribed alongside it;
+// its frames are dropped until the primary fails, and then it is promoted on the spot. A
+// lost connection is reopened at once, then with jittered exponential backoff, to a cached
+// address and resuming the cached TLS session, so a reconnect costs one TCP and one
+// abbreviated TLS handshake.
+typedef enum { CONN_PRIMARY, CONN_STANDBY } conn_role_t;
+
+// Request waiting for LWS_CALLBACK_CLIENT_WRITEABLE (subscription changes from --control).
+typedef struct ws_msg {
+    struct ws_msg *next;
+    int len;
+    char data[];
+} ws_msg_t;
+
+typedef struct {
+    struct lws *wsi;          // NULL while disconnected
+    conn_role_t role;
+    int shard;                // Instruments it subscribes to (instruments[].shard)
+    int established;          // Websocket handshake done, subscribe sent
+    int failures;             // Failed attempts since the last established connection
+    double next_attempt;      // Monotonic time of the next connect attempt
+    uint64_t frames;          // Frames received on this connection
+    int fd;                   // Socket while established (--rx-timestamps)
+    double kernel_time;       // Kernel receive time of its next frames (--rx-timestamps)
+    double last_frame;        // Monotonic time of the latest frame, pongs included
+    double ping_sent;         // When the unanswered ping went out (0: none)
+    int ping_pending;         // Ping waiting for LWS_CALLBACK_CLIENT_WRITEABLE
+    int closing;              // Close requested after a missed pong
+    ws_msg_t *outbox;         // Requests to send, oldest first
+    ws_msg_t *outbox_tail;
+    uint64_t pings, silent_closes;
+} ws_conn_t;
+
+static ws_conn_t ws_conns[2 * WS_MAX_SHARDS];  // Shard s: conns_per_shard entries from s * conns_per_shard
+static int num_ws_conns = 1;
+static int num_shards = 1;
+static int conns_per_shard = 1;              // 2 with --standby or --dual-feed
+static struct lws_client_connect_info client_info;
+static char server_addr[INET6_ADDRSTRLEN];  // Cached address of options.server_host
+static double last_primary_frame[WS_MAX_SHARDS];  // Monotonic time of the latest primary frame
+static double gap_start[WS_MAX_SHARDS];     // Latest primary frame before a loss (0: no gap)
+static uint64_t gap_count = 0;
+static double gap_total = 0, gap_max = 0;
+
+static inline double monotonic_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Delay before the next attempt: none after a drop, then 100 ms, 200 ms, ... up to
+// RECONNECT_MAX_MS, each drawn from [step/2, step] so that clients do not retry in step.
+static double reconnect_delay(int failures) {
+    if (failures == 0)
+        return 0;
+    double step = RECONNECT_BASE_MS * (double)(1 << (failures < 16 ? failures - 1 : 15));
+    if (step > RECONNECT_MAX_MS)
+        step = RECONNECT_MAX_MS;
+    return (step / 2 + step / 2 * random() / RAND_MAX) / 1e3;
+}
+
+// Whether host is this machine (mock_okx.py), the only place certificates go unverified
+// unless --insecure is given.
+static int is_loopback_host(const char *host) {
+    return strcmp(host, "localhost") == 0 || strncmp(host, "127.", 4) == 0 || strcmp(host, "::1") == 0;
+}
+
+// Resolve the server once; connects reuse the address until attempts to it keep failing.
+static const char *server_address(void) {
+    if (server_addr[0])
+        return server_addr;
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(options.server_host, NULL, &hints, &res) != 0)
+        return options.server_host;  // Let lws resolve and report the error
+    const void *addr = res->ai_family == AF_INET6
+                           ? (const void *)&((struct sockaddr_in6 *)res->ai_addr)->sin6_addr
+                           : (const void *)&((struct sockaddr_in *)res->ai_addr)->sin_addr;
+    if (inet_ntop(res->ai_family, addr, server_addr, sizeof(server_addr)))
+        printf(KGRN "[WebSocket] %s resolved to %s\n" RESET, options.server_host, server_addr);
+    freeaddrinfo(res);
+    return server_addr[0] ? server_addr : options.server_host;
+}
+
+// Queue a request on an established connection, to be sent once it is writeable.
+static void ws_queue(ws_conn_t *conn, const char *data, int len) {
+    ws_msg_t *msg = malloc(sizeof(*msg) + len + 1);
+    if (!msg)
+        return;
+    msg->next = NULL;
+    msg->len = len;
+    memcpy(msg->data, data, len);
+    msg->data[len] = '\0';
+    if (conn->outbox_tail)
+        conn->outbox_tail->next = msg;
+    else
+        conn->outbox = msg;
+    conn->outbox_tail = msg;
+    lws_callback_on_writable(conn->wsi);
+}
+
+static void ws_conn_lost(ws_conn_t *conn);
+
+// Start connecting; the host name still goes out as SNI and Host header.
+static void ws_connect(ws_conn_t *conn) {
+    client_info.address = server_address();
+    client_info.opaque_user_data = conn;
+    conn->established = 0;
+    conn->next_attempt = -1;
+    if (num_shards > 1)
+        printf(KYEL "[WebSocket] Connecting %s of shard %d/%d to %s\n" RESET,
+               conn->role == CONN_PRIMARY ? "primary" : "standby", conn->shard + 1, num_shards, client_info.address);
+    else
+        printf(KYEL "[WebSocket] Connecting %s to %s\n" RESET,
+               conn->role == CONN_PRIMARY ? "primary" : "standby", client_info.address);
+    struct lws *wsi = lws_client_connect_via_info(&client_info);
+    if (conn->next_attempt >= 0)  // Already failed inside the call (CONNECTION_ERROR)
+        return;
+    if (wsi)
+        conn->wsi = wsi;
+    else
+        ws_conn_lost(conn);
+}
+
+// The other connection of conn's shard (--standby, --dual-feed), or NULL.
+static ws_conn_t *ws_partner(ws_conn_t *conn) {
+    return conns_per_shard == 2 ? &ws_conns[(conn - ws_conns) ^ 1] : NULL;
+}
+
+// connection_flag: at least one shard has its primary up.
+static void update_connection_flag(void) {
+    connection_flag = 0;
+    for (int i = 0; i < num_ws_conns; i++) {
+        if (ws_conns[i].established && ws_conns[i].role == CONN_PRIMARY)
+            connection_flag = 1;
+    }
+}
+
+// Make an established standby the primary in place of old.
+static void ws_promote(ws_conn_t *standby, ws_conn_t *old) {
+    standby->role = CONN_PRIMARY;
+    old->role = CONN_STANDBY;
+    connection_flag = 1;
+    printf(KGRN "[WebSocket] Standby promoted to primary\n" RESET);
+}
+
+// The connection closed or could not be opened: schedule the next attempt and, if it was
+// the primary, hand its role to an established standby.
+static void ws_conn_lost(ws_conn_t *conn) {
+    if (!conn->established && ++conn->failures >= 2)
+        server_addr[0] = '\0';  // Repeated failures: resolve again
+    conn->next_attempt = monotonic_now() + reconnect_delay(conn->established ? 0 : conn->failures);
+    conn->wsi = NULL;
+    conn->established = 0;
+    conn->fd = -1;
+    conn->kernel_time = 0;
+    conn->ping_sent = 0;
+    conn->ping_pending = 0;
+    conn->closing = 0;
+    // The next connection subscribes to the current set from scratch.
+    while (conn->outbox) {
+        ws_msg_t *msg = conn->outbox;
+        conn->outbox = msg->next;
+        free(msg);
+    }
+    conn->outbox_tail = NULL;
+    if (conn->role != CONN_PRIMARY)
+        return;
+
+    ws_conn_t *other = ws_partner(conn);
+    if (other && other->established && other->role == CONN_PRIMARY)
+        return;  // The other --dual-feed connection carries the shard: no gap
+    if (gap_start[conn->shard] == 0)
+        gap_start[conn->shard] = last_primary_frame[conn->shard];
+    if (other && other->established) {
+        ws_promote(other, conn);
+        return;  // The promoted standby carries on; its first frame closes the promotion gap
+    }
+    update_connection_flag();
+}
+
+// Service the websockets once, stamping the frames each delivers with the kernel receive
+// time of its socket. Waits up to timeout_ms for data (0: only checks, for --busy-poll).
+static void service_with_rx_timestamps(struct lws_context *context, int timeout_ms) {
+    struct pollfd pfds[2 * WS_MAX_SHARDS];
+    ws_conn_t *polled[2 * WS_MAX_SHARDS];
+    int n = 0;
+    for (int i = 0; i < num_ws_conns; i++) {
+        if (ws_conns[i].established && ws_conns[i].fd >= 0) {
+            pfds[n] = (struct pollfd){ ws_conns[i].fd, POLLIN, 0 };
+            polled[n++] = &ws_conns[i];
+        }
+    }
+    if (n == 0) {  // Connecting: nothing to stamp yet
+        lws_service(context, timeout_ms > 0 ? timeout_ms : -1);
+        return;
+    }
+    // lws_service_adjust_timeout returns 0 while lws still holds decrypted data from
+    // segments already read: those frames keep the stamp taken when they were peeked.
+    if (lws_service_adjust_timeout(context, 1, 0) != 0 && poll(pfds, n, timeout_ms) > 0) {
+        for (int k = 0; k < n; k++) {
+            if (pfds[k].revents & POLLIN)
+                polled[k]->kernel_time = peek_rx_timestamp(pfds[k].fd);
+        }
+    }
+    lws_service(context, -1);  // Non-blocking: the wait happened in poll
+}
+
+// Account for a frame delivered by the primary of a shard, closing an open feed gap.
+static inline void ws_primary_frame(int shard) {
+    double now = monotonic_now();
+    if (gap_start[shard] > 0) {
+        double gap = now - gap_start[shard];
+        gap_count++;
+        gap_total += gap;
+        if (gap > gap_max)
+            gap_max = gap;
+        gap_start[shard] = 0;
+        printf(KGRN "[WebSocket] Feed resumed after a %.1f ms gap\n" RESET, gap * 1e3);
+    }
+    last_primary_frame[shard] = now;
+}
+
+// --------------------- Feed Arbitration ---------------------
+// --dual-feed keeps two independent connections subscribed to the same tickers and passes
+// each update to save_trade once, from whichever connection delivers it first. Updates
+// are keyed by (instId, ts); the later copy is dropped and the time it trailed by is
+// recorded against the winning connection. Runs on the network thread only.
+typedef struct {
+    int64_t ts;          // OKX ts (ms) of the latest forwarded update
+    double arrival;      // Monotonic time it was forwarded
+    int8_t winner;       // Connection that delivered it first
+    int8_t matched;      // The other connection's copy has arrived
+} arb_slot_t;
+
+static arb_slot_t arb_slots[MAX_INSTRUMENTS];
+static uint64_t arb_wins[MAX_INSTRUMENTS][2];  // Races won per instrument and connection
+static latency_hist_t arb_lead[2];             // Margin of each connection's wins
+static uint64_t arb_forwarded = 0, arb_late = 0;
+
+// Locate the string value of "key":"..." in a frame; returns NULL if absent.
+static const char *frame_field(const char *frame, size_t frame_len, const char *key, size_t key_len,
+                               size_t *value_len) {
+    const char *p = memmem(frame, frame_len, key, key_len);
+    if (!p)
+        return NULL;
+    p += key_len;
+    const char *end = memchr(p, '"', frame_len - (size_t)(p - frame));
+    if (!end)
+        return NULL;
+    *value_len = (size_t)(end - p);
+    return p;
+}
+
+// Whether a frame received on connection conn carries an update not yet forwarded.
+// Frames without an instId and ts (subscription events, pongs) always pass.
+static int arbitrate_frame(int conn, const char *frame, size_t len) {
+    static const char inst_key[] = "\"instId\":\"", ts_key[] = "\"ts\":\"";
+    size_t inst_len, ts_len;
+    const char *inst = frame_field(frame, len, inst_key, sizeof(inst_key) - 1, &inst_len);
+    const char *ts_str = frame_field(frame, len, ts_key, sizeof(ts_key) - 1, &ts_len);
+    if (!inst || !ts_str)
+        return 1;
+    inst_id_t id = intern_lookup(inst, inst_len);
+    if (id == INST_ID_NONE)
+        return 1;
+    int64_t ts = 0;
+    for (size_t i = 0; i < ts_len && ts_str[i] >= '0' && ts_str[i] <= '9'; i++)
+        ts = ts * 10 + (ts_str[i] - '0');
+
+    arb_slot_t *slot = &arb_slots[id];
+    double now = monotonic_now();
+    if (ts > slot->ts || (ts == slot->ts && conn == slot->winner)) {
+        // New update (a winner repeating ts is a second update within the millisecond).
+        slot->ts = ts;
+        slot->arrival = now;
+        slot->winner = (int8_t)conn;
+        slot->matched = 0;
+        arb_forwarded++;
+        return 1;
+    }
+    if (ts == slot->ts && !slot->matched) {
+        slot->matched = 1;
+        arb_wins[id][slot->winner]++;
+        latency_record(&arb_lead[slot->winner], now - slot->arrival);
+    } else {
+        arb_late++;  // Copy of an update already superseded by a newer one
+    }
+    return 0;
+}
+
+// Print which connection won the races, per instrument, and by what margin.
+static void report_arbitration(void) {
+    uint64_t wins[2] = { 0, 0 };
+    printf(KGRN "[Arbitration] %llu updates forwarded, %llu late copies dropped\n" RESET,
+           (unsigned long long)arb_forwarded, (unsigned long long)arb_late);
+    for (int i = 0; i < num_instruments; i++) {
+        uint64_t races = arb_wins[i][0] + arb_wins[i][1];
+        wins[0] += arb_wins[i][0];
+        wins[1] += arb_wins[i][1];
+        if (races > 0)
+            printf("[Arbitration] %-10s %llu races: connection 1 won %.1f%%, connection 2 won %.1f%%\n",
+                   instruments[i].instrument, (unsigned long long)races,
+                   100.0 * arb_wins[i][0] / races, 100.0 * arb_wins[i][1] / races);
+    }
+    for (int c = 0; c < 2; c++) {
+        const latency_hist_t *h = &arb_lead[c];
+        if (h->count > 0)
+            printf("[Arbitration] connection %d won %llu races, lead p50 %.1f us, p90 %.1f us, "
+                   "p99 %.1f us, max %.1f us\n", c + 1, (unsigned long long)wins[c],
+                   latency_percentile(h, 0.50) / 1e3, latency_percentile(h, 0.90) / 1e3,
+                   latency_percentile(h, 0.99) / 1e3, h->max_ns / 1e3);
+    }
+}
+
+// --------------------- Conflation ---------------------
+// --conflate moves parsing and storage off the network thread. The network thread only
+// finds a frame's instId and swaps a copy into that instrument's slot; the ingest thread
+// takes the slots in arrival order and passes them to save_trade. A frame arriving while
+// its instrument's previous one is still unprocessed replaces it and is counted as
+// conflated, so under overload the backlog is bounded by one frame per instrument and
+// the minute pass sees the latest prices instead of falling further behind the feed.
+// Only tickers snapshots are conflated: every trades frame carries distinct trades, so
+// those are pushed on a per-instrument stack instead and all of them are stored.
+typedef struct conflate_msg {
+    struct conflate_msg *next;  // Older pending trades frame of the same instrument
+    uint64_t seq;          // Arrival order, to interleave the ticker with the trades
+    double queued;         // Monotonic time the frame was put in its slot
+    double kernel_time;    // As frame_kernel_time and frame_callback_time when received
+    double callback_time;
+    size_t len;
+    char data[];
+} conflate_msg_t;
+
+static conflate_msg_t *conflate_slots[MAX_INSTRUMENTS];   // Latest unprocessed ticker (atomic swap)
+static conflate_msg_t *conflate_trades[MAX_INSTRUMENTS];  // Unprocessed trades frames, newest first
+static uint8_t conflate_pending[MAX_INSTRUMENTS];         // Id is in the ring (atomic swap)
+static inst_id_t conflate_ring[MAX_INSTRUMENTS];  // Ids with pending frames; each one at most once
+static uint64_t conflate_head = 0, conflate_tail = 0;  // Written by the network / ingest thread
+static sem_t conflate_ready;          // Posted once per id put in the ring
+static pthread_t conflate_tid;
+static volatile int conflate_running = 0;
+static uint64_t conflate_queued = 0, conflate_replaced = 0;  // Network thread only (also the seq)
+static uint64_t conflate_counts[MAX_INSTRUMENTS];            // Replaced frames per instrument
+static latency_hist_t conflate_wait;  // Slot to save_trade, ingest thread only
+
+// Hand a data frame to the ingest thread (network thread). Frames without data
+// (subscription events) or for unknown instruments are dropped, as save_trade would.
+static void conflate_frame(const char *frame, size_t len, double kernel_time, double callback_time) {
+    static const char inst_key[] = "\"instId\":\"", data_key[] = "\"data\":[", channel_key[] = "\"channel\":\"";
+    size_t inst_len, channel_len = 0;
+    const char *inst = frame_field(frame, len, inst_key, sizeof(inst_key) - 1, &inst_len);
+    const char *channel = frame_field(frame, len, channel_key, sizeof(channel_key) - 1, &channel_len);
+    if (!inst || !memmem(frame, len, data_key, sizeof(data_key) - 1))
+        return;
+    inst_id_t id = intern_lookup(inst, inst_len);
+    if (id == INST_ID_NONE)
+        return;
+    conflate_msg_t *msg = malloc(sizeof(*msg) + len);
+    if (!msg)
+        return;
+    msg->seq = conflate_queued;
+    msg->queued = monotonic_now();
+    msg->kernel_time = kernel_time;
+    msg->callback_time = callback_time;
+    msg->len = len;
+    memcpy(msg->data, frame, len);
+    conflate_queued++;
+
+    // A trades frame is pushed on the instrument's stack; the network thread never reads a
+    // frame it has handed over, since the ingest thread may already have freed it. Any
+    // other frame replaces the pending ticker, if the ingest thread has not taken it.
+    if (channel && channel_len == 6 && memcmp(channel, "trades", 6) == 0) {
+        msg->next = __atomic_load_n(&conflate_trades[id], __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&conflate_trades[id], &msg->next, msg, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            ;
+    } else {
+        msg->next = NULL;
+        conflate_msg_t *old = __atomic_exchange_n(&conflate_slots[id], msg, __ATOMIC_ACQ_REL);
+        if (old) {
+            free(old);
+            conflate_replaced++;
+            conflate_counts[id]++;
+        }
+    }
+    if (__atomic_exchange_n(&conflate_pending[id], 1, __ATOMIC_ACQ_REL))
+        return;  // Its id is already in the ring
+    conflate_ring[conflate_head % MAX_INSTRUMENTS] = id;
+    __atomic_store_n(&conflate_head, conflate_head + 1, __ATOMIC_RELEASE);
+    sem_post(&conflate_ready);
+}
+
+static void *conflate_thread(void *arg) {
+    (void)arg;
+    for (;;) {
+        sem_wait(&conflate_ready);
+        if (conflate_tail == __atomic_load_n(&conflate_head, __ATOMIC_ACQUIRE))
+            break;  // Posted by conflate_stop
+        inst_id_t id = conflate_ring[conflate_tail % MAX_INSTRUMENTS];
+        __atomic_store_n(&conflate_tail, conflate_tail + 1, __ATOMIC_RELEASE);
+        // Clearing the flag before emptying the slots lets the network thread put the id in
+        // the ring again for any frame that misses this pass (at worst an empty pass).
+        __atomic_store_n(&conflate_pending[id], 0, __ATOMIC_SEQ_CST);
+        conflate_msg_t *ticker = __atomic_exchange_n(&conflate_slots[id], NULL, __ATOMIC_ACQ_REL);
+        conflate_msg_t *newest = __atomic_exchange_n(&conflate_trades[id], NULL, __ATOMIC_ACQ_REL);
+        // Store the trades frames in arrival order, with the ticker at its place among them.
+        conflate_msg_t *msg = NULL;
+        while (newest) {
+            conflate_msg_t *next = newest->next;
+            if (ticker && ticker->seq > newest->seq) {
+                ticker->next = msg;
+                msg = ticker;
+                ticker = NULL;
+            }
+            newest->next = msg;
+            msg = newest;
+            newest = next;
+        }
+        if (ticker) {
+            ticker->next = msg;
+            msg = ticker;
+        }
+        while (msg) {
+            conflate_msg_t *next = msg->next;
+            latency_record(&conflate_wait, monotonic_now() - msg->queued);
+            frame_kernel_time = msg->kernel_time;
+            frame_callback_time = msg->callback_time;
+            save_trade(msg->data, msg->len);
+            free(msg);
+            msg = next;
+        }
+    }
+    return NULL;
+}
+
+static void conflate_start(void) {
+    sem_init(&conflate_ready, 0, 0);
+    if (pthread_create(&conflate_tid, NULL, conflate_thread, NULL) != 0) {
+        printf(KRED "[Conflation] Could not start the ingest thread; frames are stored directly\n" RESET);
+        options.conflate = 0;
+        return;
+    }
+    conflate_running = 1;
+    printf(KGRN "[Conflation] Ingest thread started; at most one pending ticker per instrument\n" RESET);
+}
+
+// Stop the ingest thread once it has caught up, then report how much was conflated.
+static void conflate_stop(void) {
+    if (!conflate_running)
+        return;
+    sem_post(&conflate_ready);
+    pthread_join(conflate_tid, NULL);
+    conflate_running = 0;
+    for (int i = 0; i < MAX_INSTRUMENTS; i++) {
+        free(conflate_slots[i]);
+        conflate_slots[i] = NULL;
+        while (conflate_trades[i]) {
+            conflate_msg_t *next = conflate_trades[i]->next;
+            free(conflate_trades[i]);
+            conflate_trades[i] = next;
+        }
+        conflate_pending[i] = 0;
+    }
+    printf(KGRN "[Conflation] %llu data frames, %llu conflated (%.2f%%)\n" RESET,
+           (unsigned long long)conflate_queued, (unsigned long long)conflate_replaced,
+           conflate_queued ? 100.0 * conflate_replaced / conflate_queued : 0.0);
+    if (conflate_wait.count > 0)
+        printf("[Conflation] slot wait p50 %.1f us, p99 %.1f us, max %.1f us\n",
+               latency_percentile(&conflate_wait, 0.50) / 1e3, latency_percentile(&conflate_wait, 0.99) / 1e3,
+               conflate_wait.max_ns / 1e3);
+    for (int i = 0; i < num_instruments; i++) {
+        if (conflate_counts[i] > 0)
+            printf("[Conflation] %-10s %llu conflated\n", instruments[i].instrument,
+                   (unsigned long long)conflate_counts[i]);
+    }
+}
+
+// --------------------- Feed Health ---------------------
+// OKX closes connections that stay idle for 30 s, and a half-open TCP connection can stay
+// silent far longer before LWS_CALLBACK_CLIENT_CLOSED. Each connection therefore sends a
+// text "ping" once it has been quiet for PING_IDLE_MS and is closed, and reopened, if no
+// frame at all follows within PONG_TIMEOUT_MS. Each instrument is also compared with its
+// own tick rate: it is stale once silent for STALE_FACTOR times its usual interval, and a
+// feed whose instruments are all stale is reconnected even though it still answers pings.
+static int inst_stale[MAX_INSTRUMENTS];
+static double last_silence_reconnect[WS_MAX_SHARDS];
+
+// Ask for a connection to be closed; LWS_CALLBACK_CLIENT_CLOSED then reconnects it.
+static void ws_close(ws_conn_t *conn) {
+    if (!conn->wsi || conn->closing)
+        return;
+    conn->closing = 1;
+    conn->silent_closes++;
+    lws_set_timeout(conn->wsi, PENDING_TIMEOUT_USER_OK, LWS_TO_KILL_ASYNC);
+}
+
+static void check_connections(double now) {
+    for (int i = 0; i < num_ws_conns; i++) {
+        ws_conn_t *conn = &ws_conns[i];
+        if (!conn->established || conn->closing)
+            continue;
+        if (conn->ping_sent > 0) {
+            if (now - conn->ping_sent > PONG_TIMEOUT_MS / 1e3) {
+                printf(KRED "[Health] Connection %d silent for %.1f s, no pong: reconnecting\n" RESET,
+                       i + 1, now - conn->last_frame);
+                ws_close(conn);
+            }
+        } else if (now - conn->last_frame > PING_IDLE_MS / 1e3) {
+            conn->ping_sent = now;
+            conn->ping_pending = 1;
+            conn->pings++;
+            lws_callback_on_writable(conn->wsi);
+        }
+    }
+}
+
+static void check_instruments(double now) {
+    int known[WS_MAX_SHARDS] = { 0 }, stale[WS_MAX_SHARDS] = { 0 };
+    for (int i = 0; i < num_instruments; i++) {
+        // save_trade updates these under ma_mutex, on the ingest thread with --conflate.
+        pthread_mutex_lock(&ma_mutex);
+        uint64_t ticks = inst_hot[i].ticks_total;
+        double last_trade_time = inst_hot[i].last_trade_time, tick_interval = inst_hot[i].tick_interval;
+        pthread_mutex_unlock(&ma_mutex);
+        if (!INSTRUMENT_ACTIVE(i) || ticks < 2)
+            continue;  // No rate to compare with yet
+        double silence = now - last_trade_time;
+        double limit = STALE_FACTOR * tick_interval;
+        if (limit < STALE_MIN_S)
+            limit = STALE_MIN_S;
+        int is_stale = silence > limit;
+        if (is_stale != inst_stale[i]) {
+            if (is_stale)
+                printf(KRED "[Health] %s stale: no tick for %.1f s (usually every %.2f s)\n" RESET,
+                       instruments[i].instrument, silence, tick_interval);
+            else
+                printf(KGRN "[Health] %s ticking again\n" RESET, instruments[i].instrument);
+            inst_stale[i] = is_stale;
+        }
+        known[instruments[i].shard]++;
+        stale[instruments[i].shard] += is_stale;
+    }
+    // A shard whose instruments have all gone quiet is reconnected.
+    for (int s = 0; s < num_shards; s++) {
+        ws_conn_t *conns = &ws_conns[s * conns_per_shard];
+        int up = 0;
+        for (int c = 0; c < conns_per_shard; c++)
+            up |= conns[c].established && conns[c].role == CONN_PRIMARY;
+        if (known[s] == 0 || stale[s] < known[s] || !up || now - last_silence_reconnect[s] <= STALE_RECONNECT_S)
+            continue;
+        if (num_shards > 1)
+            printf(KRED "[Health] All %d instruments of shard %d stale: reconnecting\n" RESET, known[s], s + 1);
+        else
+            printf(KRED "[Health] All %d instruments stale: reconnecting\n" RESET, known[s]);
+        last_silence_reconnect[s] = now;
+        for (int c = 0; c < conns_per_shard; c++) {
+            if (conns[c].established)
+                ws_close(&conns[c]);
+        }
+    }
+}
+
+// Per-connection keepalive and close counts, printed on exit.
+static void report_connections(void) {
+    for (int i = 0; i < num_ws_conns; i++)
+        printf("[Health] connection %d (shard %d): %llu frames, %llu pings, %llu closed as silent\n", i + 1,
+               ws_conns[i].shard + 1, (unsigned long long)ws_conns[i].frames,
+               (unsigned long long)ws_conns[i].pings, (unsigned long long)ws_conns[i].silent_closes);
+}
+
+// --------------------- WebSocket Write Helper ---------------------
 static int websocket_write_back(struct lws *wsi_in, char *str, int str_size_in) {
     if (!str || !wsi_in)
         return -1;
@@ -538,49 +3592,523 @@ static int websocket_write_back(struct lws *wsi_in, char *str, int str_size_in)
     char *out = malloc(LWS_SEND_BUFFER_PRE_PADDING + len + LWS_SEND_BUFFER_POST_PADDING);
     if (!out)
         return -1;
-    memcpy(out + LWS_SEND_BUFFER_PRE_PADDING, str, len);
-    int n = lws_write(wsi_in, out + LWS_SEND_BUFFER_PRE_PADDING, len, LWS_WRITE_TEXT);
-    printf(KBLU "[websocket_write_back] %s\n" RESET, str);
-    free(out);
-    return n;
+    memcpy(out + LWS_SEND_BUFFER_PRE_PADDING, str, len);
+    int n = lws_write(wsi_in, out + LWS_SEND_BUFFER_PRE_PADDING, len, LWS_WRITE_TEXT);
+    printf(KBLU "[websocket_write_back] %s\n" RESET, str);
+    free(out);
+    return n;
+}
+
+// Build an OKX subscribe request for the interned instruments of a shard, from id *next
+// on and as many as fit in size bytes; *next is left at the first id not included.
+// Returns the length, or 0 once no instrument is left.
+int build_subscribe_message(char *buf, size_t size, int shard, int *next) {
+    int len = snprintf(buf, size, "{\"op\":\"subscribe\",\"args\":[");
+    int count = 0;
+    for (; *next < num_instruments; (*next)++) {
+        int i = *next;
+        if (!INSTRUMENT_ACTIVE(i) || instruments[i].shard != shard)
+            continue;
+        char arg[64];
+        int n = snprintf(arg, sizeof(arg), "%s{\"channel\":\"%s\",\"instId\":\"%s\"}",
+                         count ? "," : "", instruments[i].channel, instruments[i].instrument);
+        if (len + n + 3 > (int)size)  // Leave room for "]}"
+            break;
+        memcpy(buf + len, arg, (size_t)n);
+        len += n;
+        count++;
+    }
+    if (count == 0)
+        return 0;
+    memcpy(buf + len, "]}", 3);
+    return len + 2;
+}
+
+// --------------------- Runtime Subscriptions ---------------------
+// --control PATH serves a Unix stream socket taking one command per line:
+//   add INSTID [tickers|trades]   subscribe to an instrument, or switch its channel
+//   remove INSTID                 unsubscribe it and free its state
+//   list                          subscribed instruments and their channels
+// Each reply ends with a line starting with "ok" or "error". The control thread does the
+// slow part itself (allocating the window and opening the files of a new instrument,
+// flushing and closing those of a removed one) while the slot is invisible to the other
+// threads. Only the switch, interning plus the subscribe or unsubscribe request, runs on
+// the network thread between two service calls, so other instruments keep ticking.
+#ifndef OKX_FIXED_UNIVERSE
+typedef enum { CTL_SUBSCRIBE, CTL_UNSUBSCRIBE, CTL_CHANNEL } ctl_op_t;
+
+// Request from the control thread to the network thread; at most one is in flight.
+typedef struct {
+    ctl_op_t op;
+    inst_id_t id;
+    char channel[16];    // New channel (CTL_CHANNEL)
+    int pending;         // Set by the control thread, cleared by the network thread when done
+} ctl_request_t;
+
+static ctl_request_t ctl_request;
+static pthread_mutex_t ctl_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ctl_done = PTHREAD_COND_INITIALIZER;
+static int control_listen_fd = -1;
+static char control_socket_path[108];
+static pthread_t control_tid;
+
+// Queue op for instrument id on the established connections of its shard. Connections
+// still in their handshake pick the change up from build_subscribe_message.
+static void control_send_op(const char *op, inst_id_t id, const char *channel) {
+    char msg[128];
+    int len = snprintf(msg, sizeof(msg), "{\"op\":\"%s\",\"args\":[{\"channel\":\"%s\",\"instId\":\"%s\"}]}",
+                       op, channel, instruments[id].instrument);
+    for (int i = 0; i < num_ws_conns; i++) {
+        if (ws_conns[i].shard == instruments[id].shard && ws_conns[i].established && !ws_conns[i].closing)
+            ws_queue(&ws_conns[i], msg, len);
+    }
+}
+
+// Carry out the pending request (network thread).
+static void control_apply(void) {
+    ctl_request_t *req = &ctl_request;
+    moving_avg_t *inst = &instruments[req->id];
+    switch (req->op) {
+        case CTL_SUBSCRIBE:
+            // The slot may have belonged to a removed instrument.
+            memset(&arb_slots[req->id], 0, sizeof(arb_slots[0]));
+            memset(arb_wins[req->id], 0, sizeof(arb_wins[0]));
+            inst_stale[req->id] = 0;
+            conflate_counts[req->id] = 0;
+            pthread_mutex_lock(&ma_mutex);
+            memset(rx_latency[req->id], 0, sizeof(rx_latency[0]));
+            inst->state = INST_ACTIVE;
+            intern_insert(req->id);
+            pthread_mutex_unlock(&ma_mutex);
+            control_send_op("subscribe", req->id, inst->channel);
+            break;
+        case CTL_UNSUBSCRIBE:
+            control_send_op("unsubscribe", req->id, inst->channel);
+            pthread_mutex_lock(&ma_mutex);
+            inst->state = INST_RETIRING;
+            intern_rebuild();
+            for (int i = 0; i < num_instruments; i++) {
+                if (inst_hot[i].max_corr_id == req->id)
+                    inst_hot[i].max_corr_id = INST_ID_NONE;
+            }
+            pthread_mutex_unlock(&ma_mutex);
+            break;
+        case CTL_CHANNEL:
+            control_send_op("unsubscribe", req->id, inst->channel);
+            pthread_mutex_lock(&ma_mutex);
+            memcpy(inst->channel, req->channel, sizeof(inst->channel));
+            inst_hot[req->id].dedup = channel_dedup(inst->channel);
+            pthread_mutex_unlock(&ma_mutex);
+            control_send_op("subscribe", req->id, inst->channel);
+            break;
+    }
+    pthread_mutex_lock(&ctl_mutex);
+    req->pending = 0;
+    pthread_cond_signal(&ctl_done);
+    pthread_mutex_unlock(&ctl_mutex);
+}
+
+// Run a request the control thread is waiting on (main loop, between service calls).
+static inline void control_poll(void) {
+    if (__atomic_load_n(&ctl_request.pending, __ATOMIC_ACQUIRE))
+        control_apply();
+}
+
+// Hand a request to the network thread and wait until it is done; -1 if shutting down.
+static int control_submit(ctl_op_t op, inst_id_t id, const char *channel) {
+    pthread_mutex_lock(&ctl_mutex);
+    ctl_request.op = op;
+    ctl_request.id = id;
+    snprintf(ctl_request.channel, sizeof(ctl_request.channel), "%s", channel ? channel : "");
+    __atomic_store_n(&ctl_request.pending, 1, __ATOMIC_RELEASE);
+    lws_cancel_service(client_info.context);  // Wake the network thread from lws_service
+    while (ctl_request.pending && !destroy_flag) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 100000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&ctl_done, &ctl_mutex, &deadline);
+    }
+    int done = !ctl_request.pending;
+    pthread_mutex_unlock(&ctl_mutex);
+    return done ? 0 : -1;
+}
+
+// Flush and close the files of an unsubscribed instrument and free its window. The slot
+// is no longer interned and the minute pass skips it, so this runs without ma_mutex.
+static void control_retire(inst_id_t id) {
+    moving_avg_t *inst = &instruments[id];
+    journal_flush_head(id);
+    out_file_t **files[] = { &inst->journal_file, &inst->journal_idx, &inst->trans_idx, &inst->ma_idx,
+                             &inst->trans_file, &inst->ma_file, &inst->corr_file };
+    for (size_t k = 0; k < sizeof(files) / sizeof(files[0]); k++) {
+        out_close(*files[k]);
+        *files[k] = NULL;
+    }
+    window_free(inst_trades[id], inst_hot[id].capacity);
+    inst_trades[id] = NULL;
+    while (inst->blocks) {
+        trade_block_t *block = inst->blocks;
+        inst->blocks = block->next;
+        free(block);
+    }
+    inst->blocks_tail = NULL;
+    inst->block_count = 0;
+    pthread_mutex_lock(&ma_mutex);
+    memset(&inst_hot[id], 0, sizeof(inst_hot[id]));
+    inst->state = INST_FREE;
+    pthread_mutex_unlock(&ma_mutex);
+}
+
+// Whether name looks like an OKX instId (e.g. BTC-USDT, BTC-USD-SWAP).
+static int valid_inst_id(const char *name) {
+    size_t len = strlen(name);
+    if (len == 0 || len >= sizeof(instruments[0].instrument))
+        return 0;
+    for (size_t i = 0; i < len; i++) {
+        if (!isupper((unsigned char)name[i]) && !isdigit((unsigned char)name[i]) && name[i] != '-')
+            return 0;
+    }
+    return 1;
+}
+
+static void control_add(const char *name, const char *channel, char *reply, size_t size) {
+    int id = -1, existing = -1, shard = -1;
+    int load[WS_MAX_SHARDS] = { 0 };
+    pthread_mutex_lock(&ma_mutex);
+    for (int i = 0; i < num_instruments; i++) {
+        if (instruments[i].state == INST_FREE) {
+            if (id < 0)
+                id = i;
+        } else {
+            load[instruments[i].shard]++;
+            if (strcmp(instruments[i].instrument, name) == 0)
+                existing = i;
+        }
+    }
+    if (existing >= 0) {
+        int active = instruments[existing].state == INST_ACTIVE;
+        int same = strcmp(instruments[existing].channel, channel) == 0;
+        pthread_mutex_unlock(&ma_mutex);
+        if (!active)
+            snprintf(reply, size, "error %s is being added or removed\n", name);
+        else if (same)
+            snprintf(reply, size, "ok %s already on %s\n", name, channel);
+        else if (control_submit(CTL_CHANNEL, (inst_id_t)existing, channel) != 0)
+            snprintf(reply, size, "error shutting down\n");
+        else
+            snprintf(reply, size, "ok %s switched to %s\n", name, channel);
+        return;
+    }
+    if (id < 0 && num_instruments < MAX_INSTRUMENTS)
+        id = num_instruments;
+    // The least loaded connection takes it; connections are not added at runtime.
+    for (int s = 0; s < num_shards; s++) {
+        if (load[s] < INSTRUMENTS_PER_CONN && (shard < 0 || load[s] < load[shard]))
+            shard = s;
+    }
+    if (id < 0 || shard < 0) {
+        pthread_mutex_unlock(&ma_mutex);
+        if (id < 0)
+            snprintf(reply, size, "error all %d instrument slots in use\n", MAX_INSTRUMENTS);
+        else
+            snprintf(reply, size, "error all %d connections carry %d instruments\n", num_shards,
+                     INSTRUMENTS_PER_CONN);
+        return;
+    }
+    instruments[id].state = INST_PREPARING;
+    instruments[id].shard = shard;
+    if (id == num_instruments)  // Loops over the ids see the slot only once it is marked
+        __atomic_store_n(&num_instruments, id + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ma_mutex);
+
+    // Files are appended to, keeping what an earlier subscription of this session wrote.
+    if (init_instrument((inst_id_t)id, name, strlen(name), 0, 1) != 0) {
+        pthread_mutex_lock(&ma_mutex);
+        instruments[id].state = INST_FREE;
+        pthread_mutex_unlock(&ma_mutex);
+        snprintf(reply, size, "error could not allocate the trade window of %s\n", name);
+        return;
+    }
+    snprintf(instruments[id].channel, sizeof(instruments[id].channel), "%s", channel);
+    inst_hot[id].dedup = channel_dedup(channel);
+    if (control_submit(CTL_SUBSCRIBE, (inst_id_t)id, NULL) != 0)
+        snprintf(reply, size, "error shutting down\n");
+    else
+        snprintf(reply, size, "ok %s subscribed to %s (id %d)\n", name, channel, id);
+}
+
+static void control_remove(const char *name, char *reply, size_t size) {
+    int id = -1;
+    pthread_mutex_lock(&ma_mutex);
+    for (int i = 0; i < num_instruments; i++) {
+        if (instruments[i].state == INST_ACTIVE && strcmp(instruments[i].instrument, name) == 0)
+            id = i;
+    }
+    pthread_mutex_unlock(&ma_mutex);
+    if (id < 0) {
+        snprintf(reply, size, "error %s is not subscribed\n", name);
+        return;
+    }
+    if (control_submit(CTL_UNSUBSCRIBE, (inst_id_t)id, NULL) != 0) {
+        snprintf(reply, size, "error shutting down\n");
+        return;
+    }
+    control_retire((inst_id_t)id);
+    snprintf(reply, size, "ok %s unsubscribed\n", name);
+}
+
+static void control_list(char *reply, size_t size) {
+    int len = 0, count = 0;
+    pthread_mutex_lock(&ma_mutex);
+    for (int i = 0; i < num_instruments && len < (int)size; i++) {
+        if (instruments[i].state != INST_ACTIVE)
+            continue;
+        len += snprintf(reply + len, size - len, "%s %s %llu ticks\n", instruments[i].instrument,
+                        instruments[i].channel, (unsigned long long)inst_hot[i].ticks_total);
+        count++;
+    }
+    pthread_mutex_unlock(&ma_mutex);
+    if (len < (int)size)
+        snprintf(reply + len, size - len, "ok %d instruments\n", count);
+}
+
+// Parse and run one command line.
+static void control_command(char *line, char *reply, size_t size) {
+    char *save;
+    char *cmd = strtok_r(line, " \t\r", &save);
+    char *name = cmd ? strtok_r(NULL, " \t\r", &save) : NULL;
+    char *channel = name ? strtok_r(NULL, " \t\r", &save) : NULL;
+    if (!channel)
+        channel = "tickers";
+    if (cmd && strcmp(cmd, "list") == 0) {
+        control_list(reply, size);
+    } else if (cmd && (strcmp(cmd, "add") == 0 || strcmp(cmd, "remove") == 0) && name) {
+        if (!valid_inst_id(name))
+            snprintf(reply, size, "error invalid instId: %s\n", name);
+        else if (strcmp(channel, "tickers") != 0 && strcmp(channel, "trades") != 0)
+            snprintf(reply, size, "error unknown channel: %s (tickers|trades)\n", channel);
+        else if (cmd[0] == 'a')
+            control_add(name, channel, reply, size);
+        else
+            control_remove(name, reply, size);
+    } else {
+        snprintf(reply, size, "error usage: add INSTID [tickers|trades] | remove INSTID | list\n");
+    }
+    printf(KBLU "[Control] %s" RESET, reply);
+}
+
+// Serve one client until it disconnects.
+static void control_serve(int fd) {
+    char buf[CONTROL_LINE_MAX];
+    char reply[4096];
+    size_t used = 0;
+    while (!destroy_flag) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 200) <= 0)
+            continue;
+        ssize_t n = read(fd, buf + used, sizeof(buf) - 1 - used);
+        if (n <= 0)
+            return;
+        used += (size_t)n;
+        char *nl;
+        while ((nl = memchr(buf, '\n', used))) {
+            *nl = '\0';
+            control_command(buf, reply, sizeof(reply));
+            if (send(fd, reply, strlen(reply), MSG_NOSIGNAL) < 0)
+                return;
+            used -= (size_t)(nl + 1 - buf);
+            memmove(buf, nl + 1, used);
+        }
+        if (used == sizeof(buf) - 1) {
+            static const char too_long[] = "error line too long\n";
+            if (send(fd, too_long, sizeof(too_long) - 1, MSG_NOSIGNAL) < 0)
+                return;
+            used = 0;
+        }
+    }
+}
+
+static void *control_thread(void *arg) {
+    (void)arg;
+    while (!destroy_flag) {
+        struct pollfd pfd = { control_listen_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 200) <= 0)
+            continue;
+        int fd = accept4(control_listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0)
+            continue;
+        control_serve(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+// Listen on path and start the control thread.
+static int control_start(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    unlink(addr.sun_path);
+    control_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (control_listen_fd < 0 ||
+        bind(control_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(control_listen_fd, 4) != 0) {
+        printf(KRED "[Control] Could not listen on %s: %s\n" RESET, addr.sun_path, strerror(errno));
+        if (control_listen_fd >= 0)
+            close(control_listen_fd);
+        control_listen_fd = -1;
+        return -1;
+    }
+    snprintf(control_socket_path, sizeof(control_socket_path), "%s", addr.sun_path);
+    pthread_create(&control_tid, NULL, control_thread, NULL);
+    printf(KGRN "[Control] Accepting subscription commands on %s\n" RESET, addr.sun_path);
+    return 0;
+}
+
+static void control_stop(void) {
+    if (control_listen_fd < 0)
+        return;
+    pthread_join(control_tid, NULL);
+    close(control_listen_fd);
+    unlink(control_socket_path);
 }
+#else
+// The fixed universe is generated at build time and cannot grow.
+static int control_start(const char *path) {
+    (void)path;
+    printf(KRED "[Control] --control is not available in the fixed-universe build\n" RESET);
+    return -1;
+}
+
+static void control_stop(void) {}
+static inline void control_poll(void) {}
+#endif
 
 // --------------------- WebSocket Callback ---------------------
 static int ws_service_callback(struct lws *wsi, enum lws_callback_reasons reason,
                                void *user, void *in, size_t len) {
     switch (reason) {
-        case LWS_CALLBACK_CLIENT_ESTABLISHED:
-            printf(KYEL "[WebSocket] Connected to OKX\n" RESET);
-            connection_flag = 1;
-            // Subscribe to required symbols.
-            websocket_write_back(wsi,
-                "{\"op\":\"subscribe\",\"args\":["
-                    "{\"channel\":\"tickers\",\"instId\":\"BTC-USDT\"},"
-                    "{\"channel\":\"tickers\",\"instId\":\"ADA-USDT\"},"
-                    "{\"channel\":\"tickers\",\"instId\":\"ETH-USDT\"},"
-                    "{\"channel\":\"tickers\",\"instId\":\"DOGE-USDT\"},"
-                    "{\"channel\":\"tickers\",\"instId\":\"XRP-USDT\"},"
-                    "{\"channel\":\"tickers\",\"instId\":\"SOL-USDT\"},"
-                    "{\"channel\":\"tickers\",\"instId\":\"LTC-USDT\"},"
-                    "{\"channel\":\"tickers\",\"instId\":\"BNB-USDT\"}"
-                "]}",
-                -1
-            );
+        case LWS_CALLBACK_CLIENT_ESTABLISHED: {
+            ws_conn_t *conn = lws_get_opaque_user_data(wsi);
+            int primary = !conn || conn->role == CONN_PRIMARY;
+            SSL *ssl = lws_get_ssl(wsi);
+            printf(KYEL "[WebSocket] Connected to OKX (%s%s)\n" RESET, primary ? "primary" : "standby",
+                   ssl && SSL_session_reused(ssl) ? ", TLS session resumed" : "");
+            if (conn) {
+                conn->established = 1;
+                conn->failures = 0;
+                conn->last_frame = monotonic_now();
+                ws_conn_t *partner = ws_partner(conn);
+                if (!primary && partner && !(partner->established && partner->role == CONN_PRIMARY)) {
+                    ws_promote(conn, partner);  // The primary is still down: take over
+                    primary = 1;
+                }
+            }
+            if (primary)
+                connection_flag = 1;
+            int fd = lws_get_socket_fd(wsi);
+            if (conn) {
+                conn->fd = fd;
+                conn->kernel_time = 0;
+            }
+            if (options.rx_timestamps && fd >= 0)
+                enable_rx_timestamps(fd);
+            if (options.busy_poll_us > 0 && fd >= 0)
+                enable_busy_poll(fd, options.busy_poll_us);
+            if (options.ktls)
+                report_ktls(wsi);
+            // Subscribe to the shard's symbols, in requests of up to SUBSCRIBE_MAX_BYTES.
+            char sub_msg[SUBSCRIBE_MAX_BYTES];
+            int next = 0, sub_len;
+            while ((sub_len = build_subscribe_message(sub_msg, sizeof(sub_msg), conn ? conn->shard : 0, &next)) > 0) {
+                if (conn)
+                    ws_queue(conn, sub_msg, sub_len);
+                else
+                    websocket_write_back(wsi, sub_msg, sub_len);
+            }
             break;
-        case LWS_CALLBACK_CLIENT_RECEIVE:
+        }
+        case LWS_CALLBACK_CLIENT_RECEIVE: {
+            ws_conn_t *conn = lws_get_opaque_user_data(wsi);
+            if (conn) {
+                conn->last_frame = monotonic_now();
+                conn->ping_sent = 0;  // Any frame shows the connection is alive
+                if (len == 4 && memcmp(in, "pong", 4) == 0)
+                    break;
+                conn->frames++;
+                if (conn->role == CONN_STANDBY)
+                    break;  // Kept warm only
+                if (options.dual_feed && !arbitrate_frame((int)(conn - ws_conns) % conns_per_shard,
+                                                          (const char *)in, len))
+                    break;  // The other connection delivered it first
+            }
+            frames_received++;
+            ws_primary_frame(conn ? conn->shard : 0);
+            double kernel_time = conn ? conn->kernel_time : 0, callback_time = 0;
+            if (kernel_time > 0) {
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                callback_time = ts.tv_sec + ts.tv_nsec / 1e9;
+            }
             printf(KCYN_L "[Price Update] %.*s\n" RESET, (int)len, (char *)in);
-            save_trade((char *)in);
+            if (record_file) {
+                out_write(record_file, (const char *)in, len);
+                out_write(record_file, "\n", 1);
+            }
+            if (options.conflate) {
+                conflate_frame((const char *)in, len, kernel_time, callback_time);
+            } else {
+                frame_kernel_time = kernel_time;
+                frame_callback_time = callback_time;
+                save_trade((const char *)in, len);
+            }
+            if (options.quickack)
+                rearm_quickack(lws_get_socket_fd(wsi));
             break;
-        case LWS_CALLBACK_CLIENT_WRITEABLE:
+        }
+        case LWS_CALLBACK_CLIENT_WRITEABLE: {
             writeable_flag = 1;
+            ws_conn_t *conn = lws_get_opaque_user_data(wsi);
+            if (conn && conn->ping_pending) {
+                conn->ping_pending = 0;
+                websocket_write_back(wsi, "ping", 4);
+            } else if (conn && conn->outbox) {
+                ws_msg_t *msg = conn->outbox;
+                conn->outbox = msg->next;
+                if (!conn->outbox)
+                    conn->outbox_tail = NULL;
+                websocket_write_back(wsi, msg->data, msg->len);
+                free(msg);
+            }
+            // One write per callback: ask again for whatever is left.
+            if (conn && (conn->ping_pending || conn->outbox))
+                lws_callback_on_writable(wsi);
             break;
+        }
         case LWS_CALLBACK_CLIENT_CLOSED:
-            connection_flag = 0;
-            printf(KRED "[WebSocket] Disconnected from OKX\n" RESET);
+        case LWS_CALLBACK_CLIENT_CONNECTION_ERROR: {
+            ws_conn_t *conn = lws_get_opaque_user_data(wsi);
+            if (reason == LWS_CALLBACK_CLIENT_CLOSED)
+                printf(KRED "[WebSocket] Disconnected from OKX\n" RESET);
+            else
+                printf(KRED "[WebSocket] Connection error: %s\n" RESET, in ? (char *)in : "unknown");
+            if (conn)
+                ws_conn_lost(conn);
+            else
+                connection_flag = 0;
             break;
-        case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
-            connection_flag = 0;
-            printf(KRED "[WebSocket] Connection error.\n" RESET);
+        }
+        case LWS_CALLBACK_CONNECTING:
+            tune_socket((int)(intptr_t)in);  // in: the socket, not yet connected
+            break;
+        case LWS_CALLBACK_OPENSSL_LOAD_EXTRA_CLIENT_VERIFY_CERTS:
+            if (options.ktls)
+                enable_ktls((SSL_CTX *)user);  // user: the client SSL_CTX
             break;
         default:
             break;
@@ -594,18 +4122,863 @@ static struct lws_protocols protocols[] = {
     {NULL, NULL, 0, 0}
 };
 
+// Seconds elapsed between two timestamps.
+static double bench_elapsed(const struct timespec *t0, const struct timespec *t1) {
+    return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+// Open a per-thread counter of data-TLB read misses, or return -1 if perf is unavailable.
+static int open_dtlb_miss_counter(void) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// --------------------- Universe Discovery ---------------------
+// --discover okx|URL|FILE replaces the built-in symbol list with every live USDT spot
+// instrument listed by the OKX REST endpoint /api/v5/public/instruments, or by the same
+// JSON in a file or served by mock_okx.py. Price and size decimals come from each one's
+// tickSz and lotSz. For a URL, the 24h turnover from /api/v5/market/tickers on the same
+// host ranks the instruments, keeping the most traded if they outnumber MAX_INSTRUMENTS,
+// and sizes their storage: DISCOVERY_BUSY_TURNOVER or more is taken to mean a push every
+// 100 ms, and quieter instruments get proportionally smaller windows and buffers.
+#ifndef OKX_FIXED_UNIVERSE
+typedef struct {
+    char inst_id[16];
+    int price_decimals;   // -1: unknown
+    int size_decimals;
+    double turnover;      // 24h volume in USDT (0: unknown)
+} discovered_t;
+
+// GET an https:// URL over HTTP/1.0 (no chunked body). Certificates are verified except
+// for loopback hosts (mock_okx.py). Returns the malloc'd, NUL-terminated body or NULL.
+static char *https_get(const char *url, size_t *len_out) {
+    const char *host_start = url + strlen("https://");
+    const char *path = strchr(host_start, '/');
+    if (!path)
+        path = "/";
+    char host[256], port[8] = "443";
+    snprintf(host, sizeof(host), "%.*s", (int)(path - host_start), host_start);
+    char *colon = strchr(host, ':');
+    if (colon) {
+        snprintf(port, sizeof(port), "%s", colon + 1);
+        *colon = '\0';
+    }
+    int verify = !is_loopback_host(host) && !options.insecure;
+
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    if (!ctx)
+        return NULL;
+    if (verify) {
+        SSL_CTX_set_default_verify_paths(ctx);
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+    }
+    BIO *bio = BIO_new_ssl_connect(ctx);
+    SSL *ssl = NULL;
+    char target[300];
+    snprintf(target, sizeof(target), "%s:%s", host, port);
+    if (bio) {
+        BIO_get_ssl(bio, &ssl);
+        SSL_set_tlsext_host_name(ssl, host);
+        if (verify)
+            SSL_set1_host(ssl, host);
+        BIO_set_conn_hostname(bio, target);
+    }
+    char *buf = NULL;
+    size_t len = 0, cap = 0;
+    if (!bio || BIO_do_connect(bio) <= 0 || BIO_do_handshake(bio) <= 0) {
+        printf(KRED "[Discovery] Could not connect to %s\n" RESET, target);
+    } else {
+        char request[1024];
+        int n = snprintf(request, sizeof(request),
+                         "GET %s HTTP/1.0\r\nHost: %s\r\nAccept: application/json\r\nUser-Agent: okx_client\r\n\r\n",
+                         path, host);
+        if (BIO_write(bio, request, n) == n) {
+            for (;;) {
+                if (cap - len < 65536) {
+                    cap = cap ? cap * 2 : 262144;
+                    char *grown = cap <= DISCOVERY_MAX_BYTES ? realloc(buf, cap + 1) : NULL;
+                    if (!grown)
+                        break;
+                    buf = grown;
+                }
+                int r = BIO_read(bio, buf + len, (int)(cap - len));
+                if (r <= 0)
+                    break;
+                len += (size_t)r;
+            }
+        }
+    }
+    BIO_free_all(bio);
+    SSL_CTX_free(ctx);
+    if (!buf)
+        return NULL;
+    buf[len] = '\0';
+
+    char *body = strstr(buf, "\r\n\r\n");
+    if (strncmp(buf, "HTTP/1.", 7) != 0 || !body || strncmp(buf + 8, " 200", 4) != 0) {
+        printf(KRED "[Discovery] %s: %.*s\n" RESET, url, (int)strcspn(buf, "\r\n"), buf);
+        free(buf);
+        return NULL;
+    }
+    body += 4;
+    *len_out = len - (size_t)(body - buf);
+    memmove(buf, body, *len_out + 1);
+    return buf;
+}
+
+// Load an OKX REST response ({"code":"0","data":[...]}) from a URL or a file.
+static json_t *discovery_load(const char *source) {
+    json_error_t error;
+    json_t *root;
+    if (strncmp(source, "https://", 8) == 0) {
+        size_t len;
+        char *body = https_get(source, &len);
+        if (!body)
+            return NULL;
+        root = json_loadb(body, len, 0, &error);
+        free(body);
+    } else {
+        root = json_load_file(source, 0, &error);
+    }
+    if (!root) {
+        printf(KRED "[Discovery] %s: %s\n" RESET, source, error.text);
+        return NULL;
+    }
+    json_t *code = json_object_get(root, "code");
+    if ((json_is_string(code) && strcmp(json_string_value(code), "0") != 0) ||
+        !json_is_array(json_object_get(root, "data"))) {
+        printf(KRED "[Discovery] %s: no instrument data\n" RESET, source);
+        json_decref(root);
+        return NULL;
+    }
+    return root;
+}
+
+// Decimals of a tick or lot size: "0.001" -> 3, "1" -> 0; -1 if unusable.
+static int step_decimals(const char *step) {
+    if (!step || !isdigit((unsigned char)step[0]))
+        return -1;
+    const char *dot = strchr(step, '.');
+    if (!dot)
+        return 0;
+    int n = (int)strlen(dot + 1);
+    while (n > 0 && dot[n] == '0')
+        n--;
+    return n <= MAX_DECIMALS ? n : -1;
+}
+
+static int compare_inst_id(const void *a, const void *b) {
+    return strcmp(((const discovered_t *)a)->inst_id, ((const discovered_t *)b)->inst_id);
+}
+
+static int compare_turnover(const void *a, const void *b) {
+    double ta = ((const discovered_t *)a)->turnover, tb = ((const discovered_t *)b)->turnover;
+    return (ta < tb) - (ta > tb);  // Most traded first
+}
+
+// Fill in the 24h turnover of each discovered instrument (list sorted by instId).
+static void discovery_turnover(const char *url, discovered_t *list, int n) {
+    char tickers_url[512];
+    const char *path = strchr(url + strlen("https://"), '/');
+    int host_len = path ? (int)(path - url) : (int)strlen(url);
+    snprintf(tickers_url, sizeof(tickers_url), "%.*s%s", host_len, url, DISCOVERY_TICKERS_PATH);
+    json_t *root = discovery_load(tickers_url);
+    if (!root)
+        return;
+    json_t *data = json_object_get(root, "data");
+    for (size_t i = 0; i < json_array_size(data); i++) {
+        json_t *ticker = json_array_get(data, i);
+        const char *inst_id = json_string_value(json_object_get(ticker, "instId"));
+        const char *volume = json_string_value(json_object_get(ticker, "volCcy24h"));
+        if (!inst_id || !volume || strlen(inst_id) >= sizeof(list[0].inst_id))
+            continue;
+        discovered_t key;
+        snprintf(key.inst_id, sizeof(key.inst_id), "%s", inst_id);
+        discovered_t *d = bsearch(&key, list, (size_t)n, sizeof(*list), compare_inst_id);
+        if (d)
+            d->turnover = atof(volume);
+    }
+    json_decref(root);
+}
+
+// Intern every live USDT spot instrument of source ("okx" for the OKX REST API).
+// Returns the number interned, or -1 if the list could not be obtained.
+int discover_universe(const char *source) {
+    if (strcmp(source, "okx") == 0)
+        source = DISCOVERY_URL;
+    json_t *root = discovery_load(source);
+    if (!root)
+        return -1;
+    json_t *data = json_object_get(root, "data");
+    discovered_t *list = calloc(json_array_size(data) + 1, sizeof(*list));
+    int n = 0;
+    for (size_t i = 0; list && i < json_array_size(data); i++) {
+        json_t *inst = json_array_get(data, i);
+        const char *inst_id = json_string_value(json_object_get(inst, "instId"));
+        const char *quote = json_string_value(json_object_get(inst, "quoteCcy"));
+        const char *state = json_string_value(json_object_get(inst, "state"));
+        if (!inst_id || strlen(inst_id) >= sizeof(list[0].inst_id) ||
+            (quote ? strcmp(quote, "USDT") != 0 : !strstr(inst_id, "-USDT")) ||
+            (state && strcmp(state, "live") != 0))
+            continue;
+        discovered_t *d = &list[n++];
+        snprintf(d->inst_id, sizeof(d->inst_id), "%s", inst_id);
+        d->price_decimals = step_decimals(json_string_value(json_object_get(inst, "tickSz")));
+        d->size_decimals = step_decimals(json_string_value(json_object_get(inst, "lotSz")));
+        const char *volume = json_string_value(json_object_get(inst, "volCcy24h"));  // Files may carry it
+        d->turnover = volume ? atof(volume) : 0;
+    }
+    json_decref(root);
+    if (!list || n == 0) {
+        printf(KRED "[Discovery] %s lists no live USDT spot instrument\n" RESET, source);
+        free(list);
+        return -1;
+    }
+
+    qsort(list, (size_t)n, sizeof(*list), compare_inst_id);
+    if (strncmp(source, "https://", 8) == 0)
+        discovery_turnover(source, list, n);
+    qsort(list, (size_t)n, sizeof(*list), compare_turnover);
+    if (n > MAX_INSTRUMENTS) {
+        printf(KYEL "[Discovery] Keeping the %d most traded of %d instruments\n" RESET, MAX_INSTRUMENTS, n);
+        n = MAX_INSTRUMENTS;
+    }
+
+    // Each instrument keeps up to 8 files open.
+    struct rlimit nofile;
+    rlim_t needed = (rlim_t)n * 8 + 64;
+    if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur < needed) {
+        nofile.rlim_cur = nofile.rlim_max < needed ? nofile.rlim_max : needed;
+        if (setrlimit(RLIMIT_NOFILE, &nofile) != 0 || nofile.rlim_cur < needed)
+            printf(KRED "[Discovery] Open file limit %llu is below the %llu needed\n" RESET,
+                   (unsigned long long)nofile.rlim_cur, (unsigned long long)needed);
+    }
+
+    int interned = 0, sized = 0;
+    for (int i = 0; i < n; i++) {
+        const discovered_t *d = &list[i];
+        int expected = 0;
+        if (d->turnover > 0) {
+            double share = d->turnover < DISCOVERY_BUSY_TURNOVER ? d->turnover / DISCOVERY_BUSY_TURNOVER : 1;
+            expected = (int)ceil(TICKER_MAX_PER_WINDOW * share);
+            sized++;
+        }
+        inst_id_t id = intern_instrument(d->inst_id, expected);
+        if (id == INST_ID_NONE)
+            continue;
+        if (d->price_decimals >= 0)
+            inst_hot[id].price_decimals = d->price_decimals;
+        if (d->size_decimals >= 0)
+            inst_hot[id].size_decimals = d->size_decimals;
+        interned++;
+    }
+    printf(KGRN "[Discovery] %d USDT spot instruments from %s (%d sized by 24h turnover)\n" RESET,
+           interned, source, sized);
+    free(list);
+    return interned;
+}
+#else
+int discover_universe(const char *source) {
+    (void)source;
+    printf(KRED "[Discovery] The fixed-universe build subscribes to its generated symbols; regenerate them with gen_symbols.py\n" RESET);
+    return -1;
+}
+#endif
+
+// --------------------- Replay Mode ---------------------
+// Feed a recorded stream (one websocket frame per line, as written by --record) through
+// save_trade as fast as possible, running REPLAY_MINUTE_PASSES minute passes spread evenly
+// over it, and report ingest throughput and minute-pass time. Used as the PGO workload.
+// Report the size of the compressed trade windows and how fast their blocks decode.
+static void report_trade_blocks(void) {
+    uint64_t trades = 0, bytes = 0;
+    int blocks = 0;
+    for (int i = 0; i < num_instruments; i++) {
+        for (trade_block_t *b = instruments[i].blocks; b; b = b->next) {
+            trades += b->hdr.count;
+            bytes += b->hdr.bytes;
+            blocks++;
+        }
+    }
+    if (blocks == 0) {
+        printf("[Replay] compressed window: no sealed blocks\n");
+        return;
+    }
+
+    struct timespec t0, t1;
+    journal_trade_t t;
+    int64_t sum = 0;
+    volatile int64_t sink;
+    int rounds = 0;
+    double elapsed = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    do {
+        for (int i = 0; i < num_instruments; i++) {
+            for (trade_block_t *b = instruments[i].blocks; b; b = b->next) {
+                journal_cursor_t cur;
+                journal_cursor_init(&cur, &b->hdr, b->data);
+                while (journal_next(&cur, &t))
+                    sum += t.price + t.volume;
+            }
+        }
+        rounds++;
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        elapsed = bench_elapsed(&t0, &t1);
+    } while (elapsed < 0.2);
+    sink = sum;
+    (void)sink;
+
+    printf("[Replay] compressed window: %d blocks, %llu trades, %.2f bytes/trade (flat %zu), "
+           "decode %.1f M trades/sec\n",
+           blocks, (unsigned long long)trades, (double)bytes / trades, sizeof(trade_t),
+           trades * rounds / elapsed / 1e6);
+}
+
+int run_replay(const char *path, int loops) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        printf(KRED "[Replay] Could not open %s\n" RESET, path);
+        return 1;
+    }
+
+    // Load the recording once so that file I/O is not part of the measurement.
+    size_t n_lines = 0, cap = 0;
+    char **lines = NULL;
+    size_t *lens = NULL;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t n;
+    while ((n = getline(&line, &line_cap, fp)) > 0) {
+        while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+            n--;
+        if (n == 0)
+            continue;
+        if (n_lines == cap) {
+            cap = cap ? cap * 2 : 1024;
+            lines = realloc(lines, cap * sizeof(char *));
+            lens = realloc(lens, cap * sizeof(size_t));
+        }
+        lines[n_lines] = strndup(line, n);
+        lens[n_lines] = (size_t)n;
+        n_lines++;
+    }
+    free(line);
+    fclose(fp);
+    if (n_lines == 0) {
+        printf(KRED "[Replay] %s is empty\n" RESET, path);
+        free(lines);
+        free(lens);
+        return 1;
+    }
+
+    size_t total = n_lines * (size_t)loops;
+    size_t pass_every = total / REPLAY_MINUTE_PASSES;
+    if (pass_every == 0)
+        pass_every = 1;
+    long ticks = 0;
+    int passes = 0;
+    double ingest_time = 0, ingest_max = 0, pass_time = 0, pass_max = 0;
+    struct timespec t0, t1, wall0, wall1;
+    // Only the calling thread is counted, i.e. the window scans, not the correlation threads.
+    int tlb_fd = open_dtlb_miss_counter();
+    uint64_t tlb_misses = 0;
+    out_stats_t out_before = out_stats;
+
+    clock_gettime(CLOCK_MONOTONIC, &wall0);
+    for (size_t k = 0; k < total; k++) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        ticks += save_trade(lines[k % n_lines], lens[k % n_lines]);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double dt = bench_elapsed(&t0, &t1);
+        ingest_time += dt;
+        if (dt > ingest_max)
+            ingest_max = dt;
+
+        if ((k + 1) % pass_every == 0 && passes < REPLAY_MINUTE_PASSES) {
+            struct timespec now_ts;
+            clock_gettime(CLOCK_REALTIME, &now_ts);
+            if (tlb_fd >= 0) {
+                ioctl(tlb_fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(tlb_fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            run_minute_pass(now_ts.tv_sec + now_ts.tv_nsec / 1e9);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            if (tlb_fd >= 0) {
+                uint64_t count = 0;
+                ioctl(tlb_fd, PERF_EVENT_IOC_DISABLE, 0);
+                if (read(tlb_fd, &count, sizeof(count)) == sizeof(count))
+                    tlb_misses += count;
+            }
+            double dt = bench_elapsed(&t0, &t1);
+            pass_time += dt;
+            if (dt > pass_max)
+                pass_max = dt;
+            passes++;
+        }
+    }
+    out_flush_all(OUT_NO_SYNC);
+    clock_gettime(CLOCK_MONOTONIC, &wall1);
+    double wall_time = bench_elapsed(&wall0, &wall1);
+    uint64_t out_syscalls = out_stats.syscalls - out_before.syscalls;
+
+    printf(KGRN "[Replay] %zu messages, %ld ticks stored\n" RESET, total, ticks);
+    printf("[Replay] ingest: %.3f s, %.0f ticks/sec, %.0f messages/sec\n",
+           ingest_time, ticks / ingest_time, total / ingest_time);
+    printf("[Replay] ingest latency: mean %.3f us, max %.3f us per message\n",
+           ingest_time / total * 1e6, ingest_max * 1e6);
+    printf("[Replay] output (%s, durability %s): %llu syscalls, %.0f syscalls/sec, %llu bytes, "
+           "%llu batched flushes, %llu file syncs\n",
+           output_backend_names[options.output], durability_names[options.durability],
+           (unsigned long long)out_syscalls, out_syscalls / wall_time,
+           (unsigned long long)(out_stats.bytes - out_before.bytes),
+           (unsigned long long)(out_stats.flushes - out_before.flushes),
+           (unsigned long long)(out_stats.syncs - out_before.syncs));
+    printf("[Replay] minute pass: %d runs, mean %.3f ms, max %.3f ms\n",
+           passes, passes ? pass_time / passes * 1e3 : 0.0, pass_max * 1e3);
+    if (options.window == WINDOW_COMPRESSED)
+        report_trade_blocks();
+    static const char *hugepages_names[] = { "off", "thp", "explicit" };
+    if (tlb_fd >= 0) {
+        printf("[Replay] minute pass dTLB read misses (hugepages=%s): %.0f per pass\n",
+               hugepages_names[options.hugepages], passes ? (double)tlb_misses / passes : 0.0);
+        close(tlb_fd);
+    } else {
+        printf("[Replay] minute pass dTLB read misses (hugepages=%s): n/a (perf_event_open unavailable)\n",
+               hugepages_names[options.hugepages]);
+    }
+
+    for (size_t k = 0; k < n_lines; k++)
+        free(lines[k]);
+    free(lines);
+    free(lens);
+    return 0;
+}
+
+// --------------------- Decimal Parser Benchmark ---------------------
+// Compare atof/strtod against the fixed-point and fast double parsers on typical OKX fields.
+int bench_decimal(void) {
+    static const char *samples[] = {
+        "43251.7", "0.3821", "2287.45", "0.08123", "0.5234", "101.27", "71.42", "312.8",
+        "0.00012345", "12345.678901", "1.5", "984512.123456", "0.000001", "2.0", "67000", "0.1"
+    };
+    const int n_samples = sizeof(samples) / sizeof(samples[0]);
+    const int iterations = 2000000;
+    volatile double sink_d = 0;
+    volatile int64_t sink_i = 0;
+    struct timespec t0, t1;
+
+    // Correctness: the fast double path must agree bit-for-bit with strtod.
+    int mismatches = 0;
+    for (int i = 0; i < n_samples; i++) {
+        double a = strtod(samples[i], NULL);
+        double b = parse_decimal_double(samples[i]);
+        if (a != b) {
+            printf(KRED "[Bench] Mismatch for %s: strtod=%.17g fast=%.17g\n" RESET, samples[i], a, b);
+            mismatches++;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int it = 0; it < iterations; it++)
+        sink_d += atof(samples[it % n_samples]);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double t_atof = bench_elapsed(&t0, &t1);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int it = 0; it < iterations; it++)
+        sink_d += strtod(samples[it % n_samples], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double t_strtod = bench_elapsed(&t0, &t1);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int it = 0; it < iterations; it++)
+        sink_d += parse_decimal_double(samples[it % n_samples]);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double t_fast = bench_elapsed(&t0, &t1);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int it = 0; it < iterations; it++) {
+        int64_t v;
+        if (parse_decimal_fx(samples[it % n_samples], 8, &v) == 0)
+            sink_i += v;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double t_fx = bench_elapsed(&t0, &t1);
+
+    printf(KGRN "[Bench] %d conversions per parser\n" RESET, iterations);
+    printf("[Bench] atof:                 %8.2f ns/op\n", t_atof / iterations * 1e9);
+    printf("[Bench] strtod:               %8.2f ns/op\n", t_strtod / iterations * 1e9);
+    printf("[Bench] parse_decimal_double: %8.2f ns/op\n", t_fast / iterations * 1e9);
+    printf("[Bench] parse_decimal_fx:     %8.2f ns/op\n", t_fx / iterations * 1e9);
+    printf("[Bench] mismatches vs strtod: %d\n", mismatches);
+    (void)sink_d;
+    (void)sink_i;
+    return mismatches ? 1 : 0;
+}
+
+// --------------------- Busy-Poll Benchmark ---------------------
+// Compare the default sleeping service loop with --busy-poll on a loopback TCP connection.
+// A sender thread writes a CLOCK_MONOTONIC timestamp every BENCH_POLL_INTERVAL_US; the
+// receiver waits the way the main loop does (poll with a 50 ms timeout, or a pinned spin
+// of zero-timeout polls) and records send-to-read latency, while the system CPU idle is
+// sampled from /proc/stat as cpu_idle_monitor does.
+typedef struct {
+    int fd;
+    volatile int stop;
+    uint64_t sent;
+} bench_sender_t;
+
+static void *bench_poll_sender(void *arg) {
+    bench_sender_t *sender = arg;
+    struct timespec interval = { 0, BENCH_POLL_INTERVAL_US * 1000L };
+    while (!sender->stop) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        int64_t ns = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+        if (write(sender->fd, &ns, sizeof(ns)) != sizeof(ns))
+            break;
+        sender->sent++;
+        nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+// Connected loopback TCP pair; returns 0 on success.
+static int bench_poll_connect(int *rx, int *tx) {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0)
+        return -1;
+    int rc = -1;
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0 && listen(listener, 1) == 0 &&
+        getsockname(listener, (struct sockaddr *)&addr, &addr_len) == 0) {
+        *tx = socket(AF_INET, SOCK_STREAM, 0);
+        if (*tx >= 0 && connect(*tx, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+            (*rx = accept(listener, NULL, NULL)) >= 0) {
+            int one = 1;
+            setsockopt(*tx, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            fcntl(*rx, F_SETFL, fcntl(*rx, F_GETFL) | O_NONBLOCK);
+            rc = 0;
+        } else if (*tx >= 0) {
+            close(*tx);
+        }
+    }
+    close(listener);
+    return rc;
+}
+
+// Run one mode for BENCH_POLL_SECONDS; returns the CPU idle percentage, or -1 on error.
+static double bench_poll_mode(int busy, int cpu, latency_hist_t *hist, uint64_t *sent) {
+    int rx, tx;
+    if (bench_poll_connect(&rx, &tx) != 0) {
+        printf(KRED "[Bench] Could not open a loopback connection: %s\n" RESET, strerror(errno));
+        return -1;
+    }
+    cpu_set_t saved;
+    pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved);
+    if (busy) {
+        pin_thread_to_cpu(cpu);
+        if (options.busy_poll_us > 0)
+            enable_busy_poll(rx, options.busy_poll_us);
+    }
+
+    bench_sender_t sender = { tx, 0, 0 };
+    pthread_t sender_thread;
+    pthread_create(&sender_thread, NULL, bench_poll_sender, &sender);
+
+    unsigned long idle0 = 0, total0 = 0, idle1 = 0, total1 = 0;
+    read_cpu_times(&idle0, &total0);
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    uint8_t buf[4096];
+    size_t fill = 0;
+    do {
+        struct pollfd pfd = { rx, POLLIN, 0 };
+        if (poll(&pfd, 1, busy ? 0 : 50) > 0) {
+            ssize_t n = read(rx, buf + fill, sizeof(buf) - fill);
+            if (n > 0) {
+                fill += (size_t)n;
+                clock_gettime(CLOCK_MONOTONIC, &t1);
+                int64_t now = (int64_t)t1.tv_sec * 1000000000LL + t1.tv_nsec;
+                size_t used = 0;
+                for (; used + sizeof(int64_t) <= fill; used += sizeof(int64_t)) {
+                    int64_t sent_ns;
+                    memcpy(&sent_ns, buf + used, sizeof(sent_ns));
+                    latency_record(hist, (now - sent_ns) / 1e9);
+                }
+                memmove(buf, buf + used, fill - used);
+                fill -= used;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+    } while (bench_elapsed(&t0, &t1) < BENCH_POLL_SECONDS);
+    read_cpu_times(&idle1, &total1);
+
+    sender.stop = 1;
+    pthread_join(sender_thread, NULL);
+    pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+    close(rx);
+    close(tx);
+    *sent = sender.sent;
+    return cpu_idle_percent(idle0, total0, idle1, total1);
+}
+
+int bench_busy_poll(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int cpu = options.busy_poll_cpu >= 0 ? options.busy_poll_cpu : (int)(cpus > 1 ? cpus - 1 : 0);
+    static latency_hist_t hist[2];
+    static const char *mode_names[2] = { "sleep (poll 50 ms)", "busy-poll" };
+
+    printf(KGRN "[Bench] %d s per mode, one message every %d us, %ld CPUs, busy-poll on CPU %d%s\n" RESET,
+           BENCH_POLL_SECONDS, BENCH_POLL_INTERVAL_US, cpus, cpu,
+           options.busy_poll_us > 0 ? " with SO_BUSY_POLL" : "");
+    for (int busy = 0; busy < 2; busy++) {
+        uint64_t sent = 0;
+        double idle = bench_poll_mode(busy, cpu, &hist[busy], &sent);
+        if (idle < 0)
+            return 1;
+        const latency_hist_t *h = &hist[busy];
+        printf("[Bench] %-18s %llu/%llu msgs, latency p50 %.1f us, p90 %.1f us, p99 %.1f us, "
+               "p99.9 %.1f us, max %.1f us, CPU idle %.1f%%\n",
+               mode_names[busy], (unsigned long long)h->count, (unsigned long long)sent,
+               latency_percentile(h, 0.50) / 1e3, latency_percentile(h, 0.90) / 1e3,
+               latency_percentile(h, 0.99) / 1e3, latency_percentile(h, 0.999) / 1e3,
+               h->max_ns / 1e3, idle);
+    }
+    return 0;
+}
+
+// Close per-instrument files and the global logs.
+void close_output_files(void) {
+    arrow_close();
+    for (int i = 0; i < num_instruments; i++) {
+        journal_flush_head((inst_id_t)i);
+        out_close(instruments[i].journal_file);
+        out_close(instruments[i].journal_idx);
+        out_close(instruments[i].trans_idx);
+        out_close(instruments[i].ma_idx);
+        out_close(instruments[i].trans_file);
+        out_close(instruments[i].ma_file);
+        out_close(instruments[i].corr_file);
+    }
+    out_close(timing_file);
+    out_close(record_file);
+    out_close(latency_file);
+    out_stop();
+}
+
 // --------------------- Main Function ---------------------
-int main(void) {
+int main(int argc, char **argv) {
+    // Parse command-line options.
+    int bench_poll = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bench-decimal") == 0) {
+            return bench_decimal();  // Benchmark mode: compare decimal parsers and exit.
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            options.record_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            options.replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--hugepages") == 0 && i + 1 < argc) {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "off") == 0)
+                options.hugepages = HUGEPAGES_OFF;
+            else if (strcmp(mode, "thp") == 0)
+                options.hugepages = HUGEPAGES_THP;
+            else if (strcmp(mode, "explicit") == 0)
+                options.hugepages = HUGEPAGES_EXPLICIT;
+            else {
+                fprintf(stderr, "Unknown --hugepages mode: %s (off|thp|explicit)\n", mode);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            const char *backend = argv[++i];
+            if (strcmp(backend, "sync") == 0)
+                options.output = OUTPUT_SYNC;
+            else if (strcmp(backend, "writev") == 0)
+                options.output = OUTPUT_WRITEV;
+            else if (strcmp(backend, "io_uring") == 0)
+                options.output = OUTPUT_IO_URING;
+            else {
+                fprintf(stderr, "Unknown --output backend: %s (sync|writev|io_uring)\n", backend);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--durability") == 0 && i + 1 < argc) {
+            const char *policy = argv[++i];
+            if (strcmp(policy, "none") == 0)
+                options.durability = DURABILITY_NONE;
+            else if (strcmp(policy, "periodic") == 0)
+                options.durability = DURABILITY_PERIODIC;
+            else if (strcmp(policy, "group") == 0)
+                options.durability = DURABILITY_GROUP;
+            else if (strcmp(policy, "minute") == 0)
+                options.durability = DURABILITY_MINUTE;
+            else {
+                fprintf(stderr, "Unknown --durability policy: %s (none|periodic|group|minute)\n", policy);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--commit-ms") == 0 && i + 1 < argc) {
+            options.commit_ms = atoi(argv[++i]);
+            if (options.commit_ms < 1)
+                options.commit_ms = 1;
+        } else if (strcmp(argv[i], "--rotate") == 0 && i + 1 < argc) {
+            const char *rotate = argv[++i];
+            if (strcmp(rotate, "none") == 0)
+                options.rotate = ROTATE_NONE;
+            else if (strcmp(rotate, "daily") == 0)
+                options.rotate = ROTATE_DAILY;
+            else if (strcmp(rotate, "hourly") == 0)
+                options.rotate = ROTATE_HOURLY;
+            else {
+                fprintf(stderr, "Unknown --rotate period: %s (none|daily|hourly)\n", rotate);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc) {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "flat") == 0)
+                options.window = WINDOW_FLAT;
+            else if (strcmp(mode, "compressed") == 0)
+                options.window = WINDOW_COMPRESSED;
+            else {
+                fprintf(stderr, "Unknown --window mode: %s (flat|compressed)\n", mode);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--arrow") == 0 && i + 1 < argc) {
+            options.arrow_path = argv[++i];
+        } else if (strcmp(argv[i], "--rx-timestamps") == 0) {
+            options.rx_timestamps = 1;
+        } else if (strcmp(argv[i], "--busy-poll") == 0 && i + 1 < argc) {
+            options.busy_poll_cpu = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--busy-poll-us") == 0 && i + 1 < argc) {
+            options.busy_poll_us = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bench-busy-poll") == 0) {
+            bench_poll = 1;  // Run after parsing, so that --busy-poll CPU/--busy-poll-us apply
+        } else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            static char host[256];
+            const char *colon = strrchr(argv[++i], ':');
+            snprintf(host, sizeof(host), "%.*s", colon ? (int)(colon - argv[i]) : (int)strlen(argv[i]), argv[i]);
+            options.server_host = host;
+            if (colon)
+                options.server_port = atoi(colon + 1);
+        } else if (strcmp(argv[i], "--insecure") == 0) {
+            options.insecure = 1;
+        } else if (strcmp(argv[i], "--tcp-nodelay") == 0) {
+            options.tcp_nodelay = 1;
+        } else if (strcmp(argv[i], "--rcvbuf") == 0 && i + 1 < argc) {
+            options.rcvbuf = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--quickack") == 0) {
+            options.quickack = 1;
+        } else if (strcmp(argv[i], "--ktls") == 0) {
+            options.ktls = 1;
+        } else if (strcmp(argv[i], "--standby") == 0) {
+            options.standby = 1;
+        } else if (strcmp(argv[i], "--dual-feed") == 0) {
+            options.dual_feed = 1;
+        } else if (strcmp(argv[i], "--control") == 0 && i + 1 < argc) {
+            options.control_path = argv[++i];
+        } else if (strcmp(argv[i], "--discover") == 0 && i + 1 < argc) {
+            options.discover = argv[++i];
+        } else if (strcmp(argv[i], "--conflate") == 0) {
+            options.conflate = 1;
+        } else if (strcmp(argv[i], "--dedup") == 0 && i + 1 < argc) {
+            // [CHANNEL=]MODE, the channel defaulting to tickers
+            const char *arg = argv[++i], *eq = strchr(arg, '=');
+            const char *mode = eq ? eq + 1 : arg;
+            char channel[16];
+            snprintf(channel, sizeof(channel), "%.*s", eq ? (int)(eq - arg) : 0, arg);
+            dedup_mode_t *target = &options.dedup_tickers;
+            if (strcmp(channel, "trades") == 0)
+                target = &options.dedup_trades;
+            else if (eq && strcmp(channel, "tickers") != 0) {
+                fprintf(stderr, "Unknown --dedup channel: %s (tickers|trades)\n", channel);
+                return 1;
+            }
+            if (strcmp(mode, "off") == 0)
+                *target = DEDUP_OFF;
+            else if (strcmp(mode, "drop") == 0)
+                *target = DEDUP_DROP;
+            else if (strcmp(mode, "mark") == 0)
+                *target = DEDUP_MARK;
+            else {
+                fprintf(stderr, "Unknown --dedup mode: %s (off|drop|mark)\n", mode);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--replay-loops") == 0 && i + 1 < argc) {
+            options.replay_loops = atoi(argv[++i]);
+            if (options.replay_loops < 1)
+                options.replay_loops = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [--bench-decimal] [--bench-busy-poll] [--record FILE] "
+                            "[--replay FILE [--replay-loops N]] [--hugepages off|thp|explicit]\n"
+                            "       [--output sync|writev|io_uring] [--durability none|periodic|group|minute]\n"
+                            "       [--commit-ms N] [--rotate none|daily|hourly] [--window flat|compressed]\n"
+                            "       [--arrow FILE|unix:PATH] [--rx-timestamps] [--busy-poll CPU [--busy-poll-us N]]\n"
+                            "       [--server HOST:PORT [--insecure]] [--tcp-nodelay] [--rcvbuf BYTES] [--quickack] [--ktls]\n"
+                            "       [--standby | --dual-feed] [--control PATH] [--discover okx|URL|FILE] [--conflate]\n"
+                            "       [--dedup [tickers=|trades=]off|drop|mark]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    if (bench_poll)
+        return bench_busy_poll();
+
+    if (options.window == WINDOW_COMPRESSED)
+        trade_head_capacity = TRADE_HEAD_SIZE;
+
     // Create top-level "data" directory.
     mkdir("data", 0777);
 
     // Open global timing log.
-    timing_file = fopen("timing.csv", "w");
-    if (timing_file) {
-        fprintf(timing_file, "Timestamp,TimeDiff\n");
-        fflush(timing_file);
+    out_start();
+    timing_file = out_open("timing.csv", "Timestamp,TimeDiff\n", 0);
+
+    // Intern the subscribed symbols so that ticks can be mapped to dense ids.
+    if (options.discover && discover_universe(options.discover) < 0) {
+        printf(KRED "[Main] Universe discovery failed, using the built-in symbols\n" RESET);
+        options.discover = NULL;
+    }
+    if (!options.discover) {
+        for (size_t i = 0; i < NUM_SUBSCRIBED; i++)
+            intern_instrument(subscribed_symbols[i], 0);
+    }
+
+    // Optional Arrow IPC stream of the minute results.
+    if (options.arrow_path && arrow_open(options.arrow_path) != 0)
+        options.arrow_path = NULL;
+
+    // Replay mode: process a recorded feed offline, report throughput and exit.
+    if (options.replay_path) {
+        int rc = run_replay(options.replay_path, options.replay_loops);
+        report_dedup();
+        close_output_files();
+        return rc;
+    }
+
+    if (options.record_path) {
+        record_file = out_open_unrotated(options.record_path, 1);
+        if (!record_file)
+            printf(KRED "[Main] Could not open record file: %s\n" RESET, options.record_path);
     }
 
+    if (options.rx_timestamps)
+        latency_file = out_open("latency.csv",
+                                "Timestamp,Instrument,Kind,Count,P50_us,P90_us,P99_us,Max_us\n", 0);
+
     // Set up signal handler.
     struct sigaction act;
     act.sa_handler = INT_HANDLER;
@@ -622,6 +4995,11 @@ int main(void) {
     info.gid = -1;
     info.uid = -1;
     info.options = LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
+#if defined(LWS_WITH_TLS_SESSIONS)
+    // Client sessions are cached per host:port and resumed on reconnect.
+    info.tls_session_timeout = TLS_SESSION_TIMEOUT_S;
+    info.tls_session_cache_max = 4;
+#endif
 
     context = lws_create_context(&info);
     if (!context) {
@@ -631,23 +5009,37 @@ int main(void) {
     printf(KGRN "[Main] WebSocket context created.\n" RESET);
 
     // Prepare client connection info.
-    struct lws_client_connect_info clientInfo;
-    memset(&clientInfo, 0, sizeof(clientInfo));
-    clientInfo.context = context;
-    clientInfo.address = "ws.okx.com";
-    clientInfo.port = 8443;
-    clientInfo.path = "/ws/v5/public";
-    clientInfo.ssl_connection = LCCSCF_USE_SSL;
-    clientInfo.host = "ws.okx.com";
-    clientInfo.origin = "ws.okx.com";
-    clientInfo.protocol = protocols[0].name;
-
-    // Connect to OKX.
-    struct lws *wsi = lws_client_connect_via_info(&clientInfo);
-    if (!wsi) {
-        printf(KRED "[Main] Failed to connect.\n" RESET);
-    } else {
-        printf(KGRN "[Main] WebSocket connected.\n" RESET);
+    memset(&client_info, 0, sizeof(client_info));
+    client_info.context = context;
+    client_info.port = options.server_port;
+    client_info.path = "/ws/v5/public";
+    client_info.ssl_connection = LCCSCF_USE_SSL;
+    if (is_loopback_host(options.server_host) || options.insecure)  // Mock with a self-signed certificate
+        client_info.ssl_connection |= LCCSCF_ALLOW_SELFSIGNED | LCCSCF_SKIP_SERVER_CERT_HOSTNAME_CHECK;
+    client_info.host = options.server_host;
+    client_info.origin = options.server_host;
+    client_info.protocol = protocols[0].name;
+
+    // Parsing and storage on the ingest thread, one pending frame per instrument.
+    if (options.conflate)
+        conflate_start();
+
+    // Runtime subscription changes; needs client_info.context to wake the loop.
+    if (options.control_path)
+        control_start(options.control_path);
+
+    // One shard of connections per INSTRUMENTS_PER_CONN instruments, each with its standby.
+    // With --dual-feed both connections of a shard are primaries feeding the arbitration.
+    srandom((unsigned)time(NULL) ^ (unsigned)getpid());
+    num_shards = num_instruments > INSTRUMENTS_PER_CONN
+                     ? (num_instruments + INSTRUMENTS_PER_CONN - 1) / INSTRUMENTS_PER_CONN : 1;
+    conns_per_shard = (options.standby || options.dual_feed) ? 2 : 1;
+    num_ws_conns = num_shards * conns_per_shard;
+    for (int i = 0; i < num_ws_conns; i++) {
+        ws_conns[i].role = (i % conns_per_shard == 0 || options.dual_feed) ? CONN_PRIMARY : CONN_STANDBY;
+        ws_conns[i].shard = i / conns_per_shard;
+        ws_conns[i].fd = -1;
+        ws_conns[i].next_attempt = 0;  // Opened by the main loop
     }
 
     // Create per-minute worker thread.
@@ -658,25 +5050,57 @@ int main(void) {
     pthread_t cpu_thread;
     pthread_create(&cpu_thread, NULL, cpu_idle_monitor, NULL);
 
+    // Busy polling: pin only now, so that the threads above are not confined to the CPU.
+    int busy = options.busy_poll_cpu >= 0 && pin_thread_to_cpu(options.busy_poll_cpu) == 0;
+    if (busy)
+        printf(KGRN "[Main] Busy polling on CPU %d\n" RESET, options.busy_poll_cpu);
+
     // Main loop: run WebSocket service and attempt reconnections if disconnected.
-    time_t last_reconnect_attempt = 0;
+    double cpu_user0, cpu_sys0;
+    thread_cpu_time(&cpu_user0, &cpu_sys0);
+    double next_health_check = 0, next_connect = 0;
     while (!destroy_flag) {
-        lws_service(context, 50);
-        if (!connection_flag) {
-            time_t now = time(NULL);
-            if (now - last_reconnect_attempt >= 10) { // Attempt reconnection every 10 seconds.
-                printf(KRED "[Main] Attempting to reconnect...\n" RESET);
-                wsi = lws_client_connect_via_info(&clientInfo);
-                if (wsi) {
-                    connection_flag = 1;
-                    printf(KGRN "[Main] Reconnected.\n" RESET);
-                } else {
-                    printf(KRED "[Main] Reconnect attempt failed.\n" RESET);
-                }
-                last_reconnect_attempt = now;
+        if (options.rx_timestamps)
+            service_with_rx_timestamps(context, busy ? 0 : 50);
+        else
+            lws_service(context, busy ? -1 : 50);  // -1: service without waiting
+        control_poll();
+        // Open connections, and reopen lost ones once their backoff has elapsed, at most one
+        // per CONNECT_SPACING_MS.
+        double now = monotonic_now();
+        for (int i = 0; i < num_ws_conns && now >= next_connect; i++) {
+            if (!ws_conns[i].wsi && ws_conns[i].next_attempt >= 0 && now >= ws_conns[i].next_attempt) {
+                ws_connect(&ws_conns[i]);
+                next_connect = now + CONNECT_SPACING_MS / 1e3;
             }
         }
+        // Keepalive and staleness checks, ten times a second.
+        if (now >= next_health_check) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            check_connections(now);
+            check_instruments(ts.tv_sec + ts.tv_nsec / 1e9);
+            next_health_check = now + 0.1;
+        }
     }
+    control_stop();
+    conflate_stop();
+    report_connections();
+    report_dedup();
+    if (options.dual_feed)
+        report_arbitration();
+    if (gap_count > 0)
+        printf(KGRN "[Main] feed gaps after connection loss: %llu, mean %.1f ms, max %.1f ms\n" RESET,
+               (unsigned long long)gap_count, gap_total / gap_count * 1e3, gap_max * 1e3);
+
+    // Per-message CPU cost of the network thread (receive, TLS, parsing and storage).
+    double cpu_user, cpu_sys;
+    thread_cpu_time(&cpu_user, &cpu_sys);
+    if (frames_received > 0)
+        printf(KGRN "[Main] network thread: %llu frames, %.2f us CPU per frame (user %.2f, sys %.2f)\n" RESET,
+               (unsigned long long)frames_received,
+               (cpu_user - cpu_user0 + cpu_sys - cpu_sys0) / frames_received * 1e6,
+               (cpu_user - cpu_user0) / frames_received * 1e6, (cpu_sys - cpu_sys0) / frames_received * 1e6);
 
     printf("[Main] Closing connection...\n");
     lws_context_destroy(context);
@@ -684,17 +5108,7 @@ int main(void) {
     pthread_join(minute_thread, NULL);
     pthread_join(cpu_thread, NULL);
 
-    // Close per-instrument files.
-    for (int i = 0; i < num_instruments; i++) {
-        if (instruments[i].trans_file)
-            fclose(instruments[i].trans_file);
-        if (instruments[i].ma_file)
-            fclose(instruments[i].ma_file);
-        if (instruments[i].corr_file)
-            fclose(instruments[i].corr_file);
-    }
-    if (timing_file)
-        fclose(timing_file);
+    close_output_files();
 
     printf("[Main] WebSocket client terminated.\n");
     return 0;
@@ -0,0 +1,169 @@
+// Compressed trade blocks and sparse time indexes, shared by okx.c (in-memory trade
+// window, the on-disk journal data/<instrument>/trades.journal and the .idx files) and
+// okx_query.c, which reads them.
+//
+// A journal is a sequence of blocks, each a journal_block_hdr_t followed by `bytes` of
+// payload. The payload holds `count` trades, each encoded as four varints:
+//   timestamp - zigzag delta-of-delta of the arrival time in nanoseconds
+//               (the first trade's time is first_ts_ns, its delta is 0)
+//   price     - zigzag delta of the fixed-point price (the first delta is from 0)
+//   volume    - zigzag fixed-point volume
+//   delay     - zigzag processing delay in nanoseconds
+// Prices and volumes are scaled by 10^price_decimals and 10^size_decimals. Consecutive
+// ticks arrive at similar intervals with nearby prices, so most fields take 1-2 bytes.
+#ifndef OKX_JOURNAL_H
+#define OKX_JOURNAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define JOURNAL_MAGIC 0x424B584FU     // "OKXB", little-endian
+#define JOURNAL_MAX_TRADE_BYTES 40    // Worst case: four 10-byte varints
+
+typedef struct {
+    uint32_t magic;
+    uint16_t count;                   // Trades in the block
+    uint8_t price_decimals;
+    uint8_t size_decimals;
+    uint32_t bytes;                   // Payload size
+    uint32_t reserved;
+    int64_t first_ts_ns;              // Arrival time of the first trade (ns since epoch)
+    int64_t last_ts_ns;               // Arrival time of the last trade
+} journal_block_hdr_t;
+
+// Sparse time index (<file>.idx) written next to the journal and the CSV outputs: one
+// entry per journal block and one per INDEX_STRIDE CSV rows. Rows before `offset` are no
+// later than ts_ns, rows from `offset` on are no earlier.
+typedef struct {
+    int64_t ts_ns;                    // Time of the row starting at offset
+    uint64_t offset;                  // Byte offset of that row in the data file
+} journal_index_entry_t;
+
+// A decoded trade.
+typedef struct {
+    int64_t ts_ns;
+    int64_t price;
+    int64_t volume;
+    int64_t delay_ns;
+} journal_trade_t;
+
+static inline uint64_t journal_zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t journal_unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static inline uint8_t *journal_put_varint(uint8_t *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static inline const uint8_t *journal_get_varint(const uint8_t *p, uint64_t *out) {
+    uint64_t v = *p++;
+    if (v < 0x80) {  // Single-byte values dominate
+        *out = v;
+        return p;
+    }
+    v &= 0x7F;
+    for (int shift = 7; shift < 64; shift += 7) {
+        uint64_t b = *p++;
+        v |= (b & 0x7F) << shift;
+        if (b < 0x80)
+            break;
+    }
+    *out = v;
+    return p;
+}
+
+// --------------------- Encoder ---------------------
+typedef struct {
+    uint8_t *start;
+    uint8_t *p;
+    int64_t prev_ts;
+    int64_t prev_delta;
+    int64_t prev_price;
+    int count;
+} journal_encoder_t;
+
+// Start a block; out must hold JOURNAL_MAX_TRADE_BYTES per trade that will be added.
+static inline void journal_encoder_init(journal_encoder_t *e, uint8_t *out, int64_t first_ts_ns) {
+    e->start = out;
+    e->p = out;
+    e->prev_ts = first_ts_ns;
+    e->prev_delta = 0;
+    e->prev_price = 0;
+    e->count = 0;
+}
+
+static inline void journal_encode_trade(journal_encoder_t *e, int64_t ts_ns, int64_t price,
+                                        int64_t volume, int64_t delay_ns) {
+    int64_t delta = ts_ns - e->prev_ts;
+    e->p = journal_put_varint(e->p, journal_zigzag(delta - e->prev_delta));
+    e->p = journal_put_varint(e->p, journal_zigzag(price - e->prev_price));
+    e->p = journal_put_varint(e->p, journal_zigzag(volume));
+    e->p = journal_put_varint(e->p, journal_zigzag(delay_ns));
+    e->prev_ts = ts_ns;
+    e->prev_delta = delta;
+    e->prev_price = price;
+    e->count++;
+}
+
+// Fill in the header of the finished block; returns the payload size.
+static inline size_t journal_encoder_finish(const journal_encoder_t *e, journal_block_hdr_t *hdr,
+                                            int64_t first_ts_ns, int price_decimals, int size_decimals) {
+    hdr->magic = JOURNAL_MAGIC;
+    hdr->count = (uint16_t)e->count;
+    hdr->price_decimals = (uint8_t)price_decimals;
+    hdr->size_decimals = (uint8_t)size_decimals;
+    hdr->bytes = (uint32_t)(e->p - e->start);
+    hdr->reserved = 0;
+    hdr->first_ts_ns = first_ts_ns;
+    hdr->last_ts_ns = e->prev_ts;
+    return hdr->bytes;
+}
+
+// --------------------- Decoder ---------------------
+typedef struct {
+    const uint8_t *p;
+    int64_t ts;
+    int64_t delta;
+    int64_t price;
+    int left;
+} journal_cursor_t;
+
+static inline void journal_cursor_init(journal_cursor_t *c, const journal_block_hdr_t *hdr,
+                                       const uint8_t *payload) {
+    c->p = payload;
+    c->ts = hdr->first_ts_ns;
+    c->delta = 0;
+    c->price = 0;
+    c->left = hdr->count;
+}
+
+// Decode the next trade; returns 0 once the block is exhausted.
+static inline int journal_next(journal_cursor_t *c, journal_trade_t *t) {
+    if (c->left == 0)
+        return 0;
+    uint64_t v;
+    c->p = journal_get_varint(c->p, &v);
+    c->delta += journal_unzigzag(v);
+    c->ts += c->delta;
+    c->p = journal_get_varint(c->p, &v);
+    c->price += journal_unzigzag(v);
+    t->ts_ns = c->ts;
+    t->price = c->price;
+    c->p = journal_get_varint(c->p, &v);
+    t->volume = journal_unzigzag(v);
+    c->p = journal_get_varint(c->p, &v);
+    t->delay_ns = journal_unzigzag(v);
+    c->left--;
+    return 1;
+}
+
+#endif // OKX_JOURNAL_H
@@ -0,0 +1,42 @@
+// Time-range queries over the files okx_client writes under data/<instrument>/.
+//
+// The active file of each output is searched through its sparse .idx time index, so a
+// query seeks straight to the first row of the range; rotated segments are selected by
+// the period in their name and gzipped ones are scanned sequentially. Built into the
+// okx_query tool (okx_query.c); compile okx_query.c with -DOKX_QUERY_NO_MAIN to link the
+// API into another program.
+#ifndef OKX_QUERY_H
+#define OKX_QUERY_H
+
+#include <stdint.h>
+
+typedef enum {
+    QUERY_TRADES,       // trades.journal (compressed blocks, --window compressed)
+    QUERY_TRADES_CSV,   // transactions.csv
+    QUERY_MA            // moving_average.csv
+} query_source_t;
+
+// Aggregates over the rows whose time lies in [start_ns, end_ns].
+typedef struct {
+    uint64_t rows;              // Rows inside the range
+    uint64_t rows_scanned;      // Rows parsed or decoded, including skipped ones
+    int64_t first_ts_ns;
+    int64_t last_ts_ns;
+    double first, last;         // Price (trades) or moving average (ma)
+    double min, max;
+    double sum;
+    double volume;              // Sum of trade sizes, or of the MA rows' 15-minute volume
+    int files;                  // Files opened
+    int indexed;                // Files entered through their .idx
+} query_result_t;
+
+// Query one instrument. Returns 0 on success, -1 if no file of the source was found.
+int okx_query(const char *data_dir, const char *instrument, query_source_t source,
+              int64_t start_ns, int64_t end_ns, query_result_t *result);
+
+// Query n instruments in parallel, one thread each. Returns the number of failed queries.
+int okx_query_many(const char *data_dir, const char *const *instruments, int n,
+                   query_source_t source, int64_t start_ns, int64_t end_ns,
+                   query_result_t *results);
+
+#endif // OKX_QUERY_H
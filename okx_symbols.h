@@ -0,0 +1,44 @@
+// Generated by gen_symbols.py -- do not edit.
+// BNB-USDT:1:6 XRP-USDT:4:6 ETH-USDT:2:6 LTC-USDT:2:6 ADA-USDT:4:6 DOGE-USDT:5:6 BTC-USDT:1:8 SOL-USDT:2:6
+#ifndef OKX_SYMBOLS_H
+#define OKX_SYMBOLS_H
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "okx_symbols.h hash assumes a little-endian target"
+#endif
+
+// X(id, instId, price_decimals, size_decimals), in id order.
+#define OKX_SYMBOLS(X) \
+    X(0, "BNB-USDT", 1, 6) \
+    X(1, "XRP-USDT", 4, 6) \
+    X(2, "ETH-USDT", 2, 6) \
+    X(3, "LTC-USDT", 2, 6) \
+    X(4, "ADA-USDT", 4, 6) \
+    X(5, "DOGE-USDT", 5, 6) \
+    X(6, "BTC-USDT", 1, 8) \
+    X(7, "SOL-USDT", 2, 6)
+
+#define OKX_NUM_SYMBOLS 8
+
+#define OKX_SYMBOL_NAME(id, name, pd, sd) name,
+static const char okx_symbol_name[OKX_NUM_SYMBOLS][16] = { OKX_SYMBOLS(OKX_SYMBOL_NAME) };
+#undef OKX_SYMBOL_NAME
+#define OKX_SYMBOL_LEN(id, name, pd, sd) sizeof(name) - 1,
+static const uint8_t okx_symbol_len[OKX_NUM_SYMBOLS] = { OKX_SYMBOLS(OKX_SYMBOL_LEN) };
+#undef OKX_SYMBOL_LEN
+
+// Minimal perfect hash: every configured instId maps to its own id.
+static inline uint16_t okx_fixed_lookup(const char *s, size_t len) {
+    uint32_t a, b;
+    if (len < 4 || len > 15)
+        return 0xFFFF;
+    memcpy(&a, s, 4);
+    memcpy(&b, s + len - 4, 4);
+    uint32_t k = a ^ (b * 31u) ^ (uint32_t)len;
+    uint32_t id = (uint32_t)(((uint64_t)(k * 0x9FB20BA7u) * OKX_NUM_SYMBOLS) >> 32);
+    if (len != okx_symbol_len[id] || memcmp(s, okx_symbol_name[id], len) != 0)
+        return 0xFFFF;
+    return (uint16_t)id;
+}
+
+#endif // OKX_SYMBOLS_H